@@ -1,6 +1,8 @@
 #include <iostream>
 #include <array>
+#include <atomic>
 #include <unordered_set>
+#include <string_view>
 
 #include <GLFW/glfw3.h>
 #include <imgui.h>
@@ -25,12 +27,42 @@ public:
         scribbles_make_border();   
     }
 
+    // the frame loop polls the result with update_painting
     void solve() {
-        paint(scribbles_);
+        colors_done_ = 0;
+        colors_ = 0;
+        paint_async(scribbles_, [this](int done, int colors) {
+            colors_done_ = done;
+            colors_ = colors;
+        });
+    }
+
+    void solve_preview() {
+        cancel_paint();
+        preview(scribbles_);
         update_drawing_texture();
     }
 
+    // uploads a snapshot the worker published since the last frame
+    void update_painting() {
+        read_snapshot(snapshot_version_, [this](const Matrix<unsigned char>& m) {
+            update_texture(m, drawing_id_);
+        });
+    }
+
+    auto painting() const -> bool {
+        return !paint_done();
+    }
+    auto colors_done() const -> int {
+        return colors_done_;
+    }
+    auto colors() const -> int {
+        return colors_;
+    }
+
+    // saves the finished paint, not the colors done so far
     void save_image() {
+        wait_paint();
         imwrite("result.png");
     }
 
@@ -77,7 +109,9 @@ public:
 
 private:
     void update_texture(const Matrix<unsigned char>& m, unsigned int& texture_id) {
-        glGenTextures(1, &texture_id);
+        // snapshots arrive every cut, uploads reuse the texture
+        if (texture_id == 0)
+            glGenTextures(1, &texture_id);
         glBindTexture(GL_TEXTURE_2D, texture_id);
 
         GLenum format = (m.channels() == 3) ? GL_RGB : GL_RGBA;
@@ -104,10 +138,13 @@ private:
 private:
     int width_{};
     int height_{};
-    unsigned int drawing_id_;
+    unsigned int drawing_id_ {0};
 
-    unsigned int scribbles_id_;
+    unsigned int scribbles_id_ {0};
     Matrix<unsigned char> scribbles_;
+    int snapshot_version_ {0};
+    std::atomic<int> colors_done_ {0};
+    std::atomic<int> colors_ {0};
 };
 
 class GUI {
@@ -140,6 +177,10 @@ public:
         glfwTerminate();
     }
 
+    void set_solver(Solver solver) {
+        painter_.set_solver(solver);
+    }
+
     bool run() {
         while (!glfwWindowShouldClose(window_)) {
             glfwPollEvents();
@@ -162,9 +203,40 @@ public:
         if (ImGui::Button("Save Image")) {
             painter_.save_image();
         }
+        static int solver = static_cast<int>(painter_.solver());
+        const char* solvers[] = {"Dinic", "Edmonds-Karp", "Boykov-Kolmogorov", "Push-relabel"};
+        if (ImGui::Combo("Solver", &solver, solvers, IM_ARRAYSIZE(solvers))) {
+            painter_.cancel_paint();
+            painter_.set_solver(static_cast<Solver>(solver));
+        }
+        // settings change between paints, not under a running one
+        static bool incremental = painter_.incremental();
+        if (ImGui::Checkbox("Reuse previous flow", &incremental)) {
+            painter_.cancel_paint();
+            painter_.set_incremental(incremental);
+        }
+        static bool multi_label = painter_.multi_label();
+        if (ImGui::Checkbox("All colors at once", &multi_label)) {
+            painter_.cancel_paint();
+            painter_.set_multi_label(multi_label);
+        }
+        static bool local_repaint = false;
+        if (ImGui::Checkbox("Repaint edited regions only", &local_repaint)) {
+            painter_.cancel_paint();
+            painter_.set_repaint_margin(local_repaint ? 16 : 0);
+        }
+        static bool live_preview = false;
+        ImGui::Checkbox("Live preview", &live_preview);
         if (ImGui::Button("Paint!")) {
             painter_.solve();
         }
+        if (painter_.painting()) {
+            ImGui::Text("Painting %d/%d colors", painter_.colors_done(), painter_.colors());
+            if (ImGui::Button("Cancel")) {
+                painter_.cancel_paint();
+            }
+        }
+        painter_.update_painting();
         ImGui::End();
 
         //ImGui::ShowDemoWindow();
@@ -183,10 +255,18 @@ public:
             rmpos.x < painter_.width() && rmpos.y < painter_.height()) 
         {
             if (ImGui::IsMouseDown(ImGuiMouseButton_Left)) {
+                // the running paint has stale scribbles
+                if (ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+                    painter_.cancel_paint();
+                }
                 painter_.draw_circle(rmpos.x, rmpos.y, 16, 
                         {u_char(col[0] * 255), u_char(col[1] * 255), u_char(col[2] * 255)});
                 painter_.update_scribbles_texture();
             }
+            // approximate colors after every stroke, "Paint!" gives the exact ones
+            if (live_preview and ImGui::IsMouseReleased(ImGuiMouseButton_Left)) {
+                painter_.solve_preview();
+            }
             //std::cout << "x:" << rmpos.x << " y:" << rmpos.y << '\n'; 
         }
         ImGui::End();
@@ -230,7 +310,20 @@ private:
 };
 
 int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <drawing> [--solver=dinic|ek|bk|pr]\n";
+        return 1;
+    }
     GUI gui{argv[1]};
+    for (int i = 2; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg.rfind("--solver=", 0) != 0)
+            continue;
+        if (auto solver = parse_solver(arg.substr(9)))
+            gui.set_solver(*solver);
+        else
+            std::cerr << "unknown solver: " << arg.substr(9) << '\n';
+    }
     gui.run();   
 
     return 0;
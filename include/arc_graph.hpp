@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "dinic.hpp"
+
+// General graph storage for solvers that work on arcs (BoykovKolmogorov).
+// Arcs are stored in pairs, so sister(a) == a ^ 1, and every node keeps
+// a linked list of its outgoing arcs.
+template <class flow_t>
+class ArcGraph {
+public:
+    ArcGraph() = delete;
+    ArcGraph(int V);
+    ~ArcGraph() = default;
+
+    void add_directional_edge(int u, int v, flow_t capacity);
+    void add_bidirectional_edge(int u, int v, flow_t capacity);
+    // removes all arcs, keeps their memory
+    void clear();
+
+    auto V() const -> int { return V_; }
+
+    auto first_arc(int node) const -> int { return first_[node]; }
+    auto next_arc(int a) const -> int { return arcs_[a].next; }
+    auto head(int a) const -> int { return arcs_[a].head; }
+    static auto sister(int a) -> int { return a ^ 1; }
+    auto capacity(int a) -> flow_t& { return arcs_[a].capacity; }
+    auto capacity(int a) const -> flow_t { return arcs_[a].capacity; }
+
+    // moves capacities of arcs leaving source and entering sink into
+    // tr_cap (>0 source->node, <0 node->sink) and returns the flow that
+    // goes straight from source to sink
+    auto fold_terminals(int source, int sink, std::vector<flow_t>& tr_cap) -> flow_t;
+
+    // returns edges in minimum cut in form <node_from, node_to>
+    auto min_cut(const std::vector<bool>& reachable) const -> std::vector<std::pair<int, int>>;
+
+    static constexpr int noarc = -1;
+
+private:
+    struct Arc {
+        int head{};
+        int next{};
+        flow_t capacity{};
+        EdgeType type{};
+
+        Arc(int _head, int _next, flow_t _capacity, EdgeType _type)
+            : head{_head}, next{_next}, capacity{_capacity}, type{_type}
+        {}
+    };
+
+private:
+    int V_ {};
+    std::vector<Arc> arcs_;
+    std::vector<int> first_;
+};
+
+template <class flow_t>
+ArcGraph<flow_t>::ArcGraph(int V)
+    : V_ {V}
+    , first_(V, noarc)
+{ }
+
+template <class flow_t>
+void ArcGraph<flow_t>::clear() {
+    arcs_.clear();
+    std::fill(first_.begin(), first_.end(), noarc);
+}
+
+template <class flow_t>
+void ArcGraph<flow_t>::add_directional_edge(int u, int v, flow_t capacity) {
+    assert(0 <= std::min(u, v) && std::max(u, v) < V_);
+    assert(capacity >= 0);
+
+    int id = static_cast<int>(arcs_.size());
+    arcs_.emplace_back(v, first_[u], capacity, DIRECTIONAL);
+    arcs_.emplace_back(u, first_[v], 0, DIRECTIONAL_REVERSE);
+    first_[u] = id;
+    first_[v] = id + 1;
+}
+
+template <class flow_t>
+void ArcGraph<flow_t>::add_bidirectional_edge(int u, int v, flow_t capacity) {
+    assert(0 <= std::min(u, v) && std::max(u, v) < V_);
+    assert(capacity >= 0);
+
+    int id = static_cast<int>(arcs_.size());
+    arcs_.emplace_back(v, first_[u], capacity, BIDIRECTIONAL);
+    arcs_.emplace_back(u, first_[v], capacity, BIDIRECTIONAL);
+    first_[u] = id;
+    first_[v] = id + 1;
+}
+
+template <class flow_t>
+auto ArcGraph<flow_t>::fold_terminals(int source, int sink, std::vector<flow_t>& tr_cap) -> flow_t {
+    flow_t flow = 0;
+    tr_cap.assign(V_, 0);
+    std::vector<flow_t> to_sink(V_, 0);
+
+    for (int a = first_[source]; a != noarc; a = arcs_[a].next) {
+        auto& e = arcs_[a];
+        if (e.head == sink)
+            flow += e.capacity;
+        else if (e.head != source)
+            tr_cap[e.head] += e.capacity;
+        e.capacity = 0;
+    }
+    for (int a = first_[sink]; a != noarc; a = arcs_[a].next) {
+        auto& e = arcs_[sister(a)];
+        if (arcs_[a].head != source and arcs_[a].head != sink)
+            to_sink[arcs_[a].head] += e.capacity;
+        e.capacity = 0;
+    }
+
+    // a node connected to both terminals passes min(in, out) straight through
+    for (int node = 0; node != V_; ++node) {
+        flow += std::min(tr_cap[node], to_sink[node]);
+        tr_cap[node] -= to_sink[node];
+    }
+
+    return flow;
+}
+
+template <class flow_t>
+auto ArcGraph<flow_t>::min_cut(const std::vector<bool>& reachable) const -> std::vector<std::pair<int, int>> {
+    std::vector<std::pair<int, int>> cut;
+
+    for (int node = 0; node < V_; node++)
+        for (int a = first_[node]; a != noarc; a = arcs_[a].next)
+            if (reachable[node] && !reachable[arcs_[a].head] && arcs_[a].type != DIRECTIONAL_REVERSE) {
+                cut.push_back({node, arcs_[a].head});
+            }
+
+    return cut;
+}
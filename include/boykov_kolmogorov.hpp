@@ -0,0 +1,602 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <functional>
+#include <cassert>
+
+#include "arc_graph.hpp"
+
+// FIFO on a ring buffer that only grows, unlike std::queue it doesn't
+// allocate and free blocks while it is drained and refilled.
+class RingQueue {
+public:
+    auto empty() const -> bool { return size_ == 0; }
+    auto front() const -> int { return items_[head_]; }
+    void pop() {
+        head_ = head_ + 1 == capacity() ? 0 : head_ + 1;
+        --size_;
+    }
+    void push(int item) {
+        if (size_ == capacity())
+            grow();
+        int tail = head_ + size_;
+        items_[tail < capacity() ? tail : tail - capacity()] = item;
+        ++size_;
+    }
+    void clear() { head_ = size_ = 0; }
+
+private:
+    auto capacity() const -> int { return static_cast<int>(items_.size()); }
+    void grow() {
+        std::rotate(items_.begin(), items_.begin() + head_, items_.end());
+        head_ = 0;
+        items_.resize(std::max<size_t>(64, 2 * items_.size()));
+    }
+
+    std::vector<int> items_;
+    int head_ {};
+    int size_ {};
+};
+
+// Boykov-Kolmogorov max-flow (search tree reuse).
+// Works best on graphs with many short augmenting paths, e.g. 4-connected
+// pixel grids. Edges going out of source and into sink are folded into
+// per-node terminal capacities when max_flow is called.
+//
+// graph_t is the graph storage: ArcGraph for arbitrary graphs or
+// GridGraph for pixel grids.
+//
+// After max_flow, capacities can be changed with add_terminal_capacity
+// and add_edge_capacity (dynamic graph cuts, Kohli & Torr). The next
+// max_flow call keeps the residual graph and the search trees, repairs
+// them around changed nodes and returns the new max flow value.
+//
+// max_flow polls the stop callback set with set_stop and returns early
+// once it says so. The flow is then only a lower bound and the partition
+// is not a cut, another max_flow call continues where it stopped.
+template <class flow_t, class graph_t = ArcGraph<flow_t>>
+class BoykovKolmogorov {
+public:
+    using graph_type = graph_t;
+
+    BoykovKolmogorov() = delete;
+    BoykovKolmogorov(int V);
+    BoykovKolmogorov(int height, int width);
+    ~BoykovKolmogorov() = default;
+
+    void add_directional_edge(int u, int v, flow_t capacity);
+    void add_bidirectional_edge(int u, int v, flow_t capacity);
+    // empty graph for a new problem without a stop callback, node
+    // arrays keep their memory
+    void clear();
+
+    auto V() const -> int { return graph_.V(); }
+    auto graph() -> graph_t& { return graph_; }
+
+    auto max_flow(int source, int sink) -> flow_t;
+    void set_stop(std::function<bool()> stop) { stop_ = std::move(stop); }
+    // the last max_flow call returned early
+    auto stopped() const -> bool { return stopped_; }
+    // returns edges in minimum cut in form <node_from, node_to>
+    auto min_cut(int source) -> std::vector<std::pair<int, int>>;
+    // reachable=1 unreachable=0
+    auto partition(int source) -> std::vector<bool>;
+
+    // only after max_flow, deltas may be negative but the resulting
+    // capacities must not
+    void add_terminal_capacity(int node, flow_t source_delta, flow_t sink_delta);
+    // changes capacities of arc a and of its sister
+    void add_edge_capacity(int a, flow_t delta, flow_t sister_delta);
+
+private:
+    enum Tree : unsigned char {
+        FREE, SOURCE_TREE, SINK_TREE
+    };
+
+    void init_trees();
+    void reuse_trees();
+    void mark_changed(int node);
+    void orphan_children(int node);
+
+    void set_active(int node);
+    auto next_active() -> int;
+
+    auto grow(int node) -> int;
+    auto augment(int connecting) -> flow_t;
+    void adopt();
+    void process_orphan(int node);
+    void make_orphan(int node);
+
+private:
+    graph_t graph_;
+    int source_ {-1};
+    int sink_ {-1};
+    bool flow_called_ {false};
+    flow_t flow_ {};
+    std::function<bool()> stop_;
+    bool stopped_ {false};
+
+    // >0 residual source->node, <0 residual node->sink
+    std::vector<flow_t> tr_cap_;
+    std::vector<int> parent_;
+    std::vector<Tree> tree_;
+    std::vector<int> ts_;
+    std::vector<int> dist_;
+    std::vector<bool> in_queue_;
+    RingQueue active_;
+    RingQueue orphans_;
+    std::vector<int> changed_;
+    std::vector<bool> is_changed_;
+    int time_ {};
+
+    static constexpr int id_infty {std::numeric_limits<int>::max()};
+    static constexpr int noarc = graph_t::noarc;
+    static constexpr int terminal = -2;
+    static constexpr int orphan = -3;
+};
+
+template <class flow_t, class graph_t>
+BoykovKolmogorov<flow_t, graph_t>::BoykovKolmogorov(int V)
+    : graph_(V)
+{ }
+
+template <class flow_t, class graph_t>
+BoykovKolmogorov<flow_t, graph_t>::BoykovKolmogorov(int height, int width)
+    : graph_(height, width)
+{ }
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::clear() {
+    graph_.clear();
+    flow_called_ = false;
+    flow_ = 0;
+    stop_ = nullptr;
+    stopped_ = false;
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::add_directional_edge(int u, int v, flow_t capacity) {
+    graph_.add_directional_edge(u, v, capacity);
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::add_bidirectional_edge(int u, int v, flow_t capacity) {
+    graph_.add_bidirectional_edge(u, v, capacity);
+}
+
+template <class flow_t, class graph_t>
+auto BoykovKolmogorov<flow_t, graph_t>::max_flow(int source, int sink) -> flow_t {
+    assert(0 <= std::min(source, sink) && std::max(source, sink) < V());
+    assert(source != sink);
+
+    if (!flow_called_) {
+        source_ = source;
+        sink_ = sink;
+        flow_ = graph_.fold_terminals(source, sink, tr_cap_);
+        init_trees();
+    }
+    else {
+        // terminal arcs were consumed by the first call
+        assert(source == source_ && sink == sink_);
+        reuse_trees();
+    }
+
+    // the clock behind a stop callback is read every poll_period grows
+    const int poll_period = 1024;
+    int until_poll = poll_period;
+    stopped_ = false;
+
+    int current = noarc;
+    while (true) {
+        if (stop_ and --until_poll == 0) {
+            until_poll = poll_period;
+            if (stop_()) {
+                // the next call grows it again
+                if (current != noarc)
+                    set_active(current);
+                stopped_ = true;
+                break;
+            }
+        }
+        int node = current;
+        current = noarc;
+        if (node == noarc or tree_[node] == FREE) {
+            node = next_active();
+            if (node == noarc)
+                break;
+        }
+
+        int connecting = grow(node);
+        if (connecting == noarc)
+            continue;
+
+        // keep growing from the same node after the path is augmented
+        flow_ += augment(connecting);
+        adopt();
+        current = node;
+    }
+
+    flow_called_ = true;
+    return flow_;
+}
+
+template <class flow_t, class graph_t>
+auto BoykovKolmogorov<flow_t, graph_t>::min_cut(int source) -> std::vector<std::pair<int, int>> {
+    assert(flow_called_);
+
+    return graph_.min_cut(partition(source));
+}
+
+template <class flow_t, class graph_t>
+auto BoykovKolmogorov<flow_t, graph_t>::partition(int source) -> std::vector<bool> {
+    assert(flow_called_);
+    assert(source == source_);
+
+    // the source tree is closed under residual arcs once max_flow returns
+    std::vector<bool> partition(V(), false);
+    for (int node = 0; node != V(); ++node)
+        partition[node] = tree_[node] == SOURCE_TREE;
+    partition[source_] = true;
+    partition[sink_] = false;
+
+    return partition;
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::init_trees() {
+    parent_.assign(V(), noarc);
+    tree_.assign(V(), FREE);
+    ts_.assign(V(), 0);
+    dist_.assign(V(), 0);
+    in_queue_.assign(V(), false);
+    is_changed_.assign(V(), false);
+    changed_.clear();
+    active_.clear();
+    orphans_.clear();
+    time_ = 0;
+
+    for (int node = 0; node != V(); ++node) {
+        if (tr_cap_[node] == 0)
+            continue;
+        tree_[node] = tr_cap_[node] > 0 ? SOURCE_TREE : SINK_TREE;
+        parent_[node] = terminal;
+        dist_[node] = 1;
+        set_active(node);
+    }
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::add_terminal_capacity(int node, flow_t source_delta, flow_t sink_delta) {
+    assert(flow_called_);
+    assert(0 <= node && node < V() && node != source_ && node != sink_);
+
+    // new residuals of node->sink and source->node arcs,
+    // the common part goes straight through the node
+    flow_t to_source = std::max(tr_cap_[node], flow_t{0}) + source_delta;
+    flow_t to_sink = std::max(-tr_cap_[node], flow_t{0}) + sink_delta;
+    flow_ += std::min(to_source, to_sink);
+    tr_cap_[node] = to_source - to_sink;
+
+    mark_changed(node);
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::add_edge_capacity(int a, flow_t delta, flow_t sister_delta) {
+    assert(flow_called_);
+
+    const int b = graph_.sister(a);
+    const int from = graph_.head(b);
+    const int to = graph_.head(a);
+    auto& cap = graph_.capacity(a);
+    auto& sister_cap = graph_.capacity(b);
+    cap += delta;
+    sister_cap += sister_delta;
+
+    // flow on the arc exceeds its new capacity: cancel the excess along
+    // source->from->to->sink, the terminal arcs take negative flow
+    if (cap < 0) {
+        flow_t excess = -cap;
+        sister_cap -= excess;
+        cap = 0;
+        flow_ -= excess;
+        add_terminal_capacity(from, excess, 0);
+        add_terminal_capacity(to, 0, excess);
+    }
+    if (sister_cap < 0) {
+        flow_t excess = -sister_cap;
+        cap -= excess;
+        sister_cap = 0;
+        flow_ -= excess;
+        add_terminal_capacity(to, excess, 0);
+        add_terminal_capacity(from, 0, excess);
+    }
+    assert(cap >= 0 && sister_cap >= 0);
+
+    mark_changed(from);
+    mark_changed(to);
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::mark_changed(int node) {
+    if (is_changed_[node])
+        return;
+    is_changed_[node] = true;
+    changed_.push_back(node);
+}
+
+// repairs the trees around changed nodes before growing again
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::reuse_trees() {
+    ++time_;
+
+    for (int node : changed_) {
+        is_changed_[node] = false;
+
+        const Tree wanted = tr_cap_[node] > 0 ? SOURCE_TREE 
+            : tr_cap_[node] < 0 ? SINK_TREE 
+            : FREE;
+
+        // a parent arc may have lost its residual capacity
+        int up = parent_[node];
+        if (up != terminal and up != orphan and up != noarc) {
+            flow_t cap = tree_[node] == SOURCE_TREE 
+                ? graph_.capacity(graph_.sister(up)) 
+                : graph_.capacity(up);
+            if (cap == 0)
+                make_orphan(node);
+        }
+
+        if (wanted != FREE and tree_[node] != wanted) {
+            // node moves to the other tree as a root
+            if (tree_[node] != FREE)
+                orphan_children(node);
+            tree_[node] = wanted;
+        }
+        if (wanted != FREE) {
+            parent_[node] = terminal;
+            ts_[node] = time_;
+            dist_[node] = 1;
+        }
+        else if (parent_[node] == terminal) {
+            make_orphan(node);
+        }
+
+        if (tree_[node] == FREE)
+            continue;
+        // neighbours may now have a path through node
+        set_active(node);
+        for (int a = graph_.first_arc(node); a != noarc; a = graph_.next_arc(a))
+            if (tree_[graph_.head(a)] != FREE)
+                set_active(graph_.head(a));
+    }
+    changed_.clear();
+
+    adopt();
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::orphan_children(int node) {
+    for (int a = graph_.first_arc(node); a != noarc; a = graph_.next_arc(a)) {
+        int neighbour = graph_.head(a);
+        if (neighbour == node or tree_[neighbour] != tree_[node])
+            continue;
+        int up = parent_[neighbour];
+        if (up != terminal and up != orphan and up != noarc and graph_.head(up) == node)
+            make_orphan(neighbour);
+    }
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::set_active(int node) {
+    if (in_queue_[node])
+        return;
+    in_queue_[node] = true;
+    active_.push(node);
+}
+
+template <class flow_t, class graph_t>
+auto BoykovKolmogorov<flow_t, graph_t>::next_active() -> int {
+    while (!active_.empty()) {
+        int node = active_.front();
+        active_.pop();
+        in_queue_[node] = false;
+        if (tree_[node] != FREE)
+            return node;
+    }
+    return noarc;
+}
+
+// returns arc from source tree to sink tree or noarc
+template <class flow_t, class graph_t>
+auto BoykovKolmogorov<flow_t, graph_t>::grow(int node) -> int {
+    const bool in_source = tree_[node] == SOURCE_TREE;
+    const Tree own = tree_[node];
+
+    for (int a = graph_.first_arc(node); a != noarc; a = graph_.next_arc(a)) {
+        // residual capacity in the direction of the tree growth
+        flow_t cap = in_source ? graph_.capacity(a) : graph_.capacity(graph_.sister(a));
+        if (cap == 0)
+            continue;
+
+        int next = graph_.head(a);
+        if (tree_[next] == FREE) {
+            tree_[next] = own;
+            parent_[next] = graph_.sister(a);
+            ts_[next] = ts_[node];
+            dist_[next] = dist_[node] + 1;
+            set_active(next);
+        }
+        else if (tree_[next] != own) {
+            return in_source ? a : graph_.sister(a);
+        }
+        else if (ts_[next] <= ts_[node] and dist_[next] > dist_[node]) {
+            // shorten the path to the root
+            parent_[next] = graph_.sister(a);
+            ts_[next] = ts_[node];
+            dist_[next] = dist_[node] + 1;
+        }
+    }
+
+    return noarc;
+}
+
+template <class flow_t, class graph_t>
+auto BoykovKolmogorov<flow_t, graph_t>::augment(int connecting) -> flow_t {
+    int from = graph_.head(graph_.sister(connecting));
+    int to = graph_.head(connecting);
+
+    // bottleneck
+    flow_t delta = graph_.capacity(connecting);
+    int node = from;
+    for (int a = parent_[node]; a != terminal; a = parent_[node]) {
+        delta = std::min(delta, graph_.capacity(graph_.sister(a)));
+        node = graph_.head(a);
+    }
+    delta = std::min(delta, tr_cap_[node]);
+
+    node = to;
+    for (int a = parent_[node]; a != terminal; a = parent_[node]) {
+        delta = std::min(delta, graph_.capacity(a));
+        node = graph_.head(a);
+    }
+    delta = std::min(delta, -tr_cap_[node]);
+
+    assert(delta > 0);
+
+    graph_.capacity(connecting) -= delta;
+    graph_.capacity(graph_.sister(connecting)) += delta;
+
+    ++time_;
+
+    // source side
+    node = from;
+    while (true) {
+        int a = parent_[node];
+        if (a == terminal) {
+            tr_cap_[node] -= delta;
+            if (tr_cap_[node] == 0)
+                make_orphan(node);
+            break;
+        }
+        int next = graph_.head(a);
+        graph_.capacity(a) += delta;
+        graph_.capacity(graph_.sister(a)) -= delta;
+        if (graph_.capacity(graph_.sister(a)) == 0)
+            make_orphan(node);
+        node = next;
+    }
+
+    // sink side
+    node = to;
+    while (true) {
+        int a = parent_[node];
+        if (a == terminal) {
+            tr_cap_[node] += delta;
+            if (tr_cap_[node] == 0)
+                make_orphan(node);
+            break;
+        }
+        int next = graph_.head(a);
+        graph_.capacity(graph_.sister(a)) += delta;
+        graph_.capacity(a) -= delta;
+        if (graph_.capacity(a) == 0)
+            make_orphan(node);
+        node = next;
+    }
+
+    return delta;
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::make_orphan(int node) {
+    if (parent_[node] == orphan)
+        return;
+    parent_[node] = orphan;
+    orphans_.push(node);
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::adopt() {
+    while (!orphans_.empty()) {
+        int node = orphans_.front();
+        orphans_.pop();
+        // changed nodes may have been made roots in the meantime
+        if (parent_[node] == orphan)
+            process_orphan(node);
+    }
+}
+
+template <class flow_t, class graph_t>
+void BoykovKolmogorov<flow_t, graph_t>::process_orphan(int node) {
+    const bool in_source = tree_[node] == SOURCE_TREE;
+    const Tree own = tree_[node];
+
+    int best_arc = noarc;
+    int best_dist = id_infty;
+
+    for (int a = graph_.first_arc(node); a != noarc; a = graph_.next_arc(a)) {
+        // residual capacity from the candidate parent towards its root
+        flow_t cap = in_source ? graph_.capacity(graph_.sister(a)) : graph_.capacity(a);
+        int candidate = graph_.head(a);
+        if (cap == 0 or tree_[candidate] != own or parent_[candidate] == noarc)
+            continue;
+
+        // check that candidate is rooted in a terminal
+        int dist = 0;
+        int cur = candidate;
+        while (true) {
+            if (ts_[cur] == time_) {
+                dist += dist_[cur];
+                break;
+            }
+            int up = parent_[cur];
+            ++dist;
+            if (up == terminal) {
+                ts_[cur] = time_;
+                dist_[cur] = 1;
+                break;
+            }
+            if (up == orphan) {
+                dist = id_infty;
+                break;
+            }
+            cur = graph_.head(up);
+        }
+        if (dist == id_infty)
+            continue;
+
+        if (dist < best_dist) {
+            best_arc = a;
+            best_dist = dist;
+        }
+        // mark the checked path with distances to the root
+        for (cur = candidate; ts_[cur] != time_; cur = graph_.head(parent_[cur])) {
+            ts_[cur] = time_;
+            dist_[cur] = dist--;
+        }
+    }
+
+    if (best_arc != noarc) {
+        parent_[node] = best_arc;
+        ts_[node] = time_;
+        dist_[node] = best_dist + 1;
+        return;
+    }
+
+    // no valid parent: node becomes free, its children become orphans
+    tree_[node] = FREE;
+    parent_[node] = noarc;
+    for (int a = graph_.first_arc(node); a != noarc; a = graph_.next_arc(a)) {
+        int neighbour = graph_.head(a);
+        if (tree_[neighbour] != own)
+            continue;
+        flow_t cap = in_source ? graph_.capacity(graph_.sister(a)) : graph_.capacity(a);
+        if (cap > 0)
+            set_active(neighbour);
+        int up = parent_[neighbour];
+        if (up != terminal and up != orphan and up != noarc and graph_.head(up) == node)
+            make_orphan(neighbour);
+    }
+}
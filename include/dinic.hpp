@@ -4,14 +4,32 @@
 #include <queue>
 #include <algorithm>
 #include <limits>
-#include <stack>
+#include <atomic>
+#include <memory>
+#include <cstdint>
 #include <cassert>
+#include <functional>
+
+#include "thread_pool.hpp"
 
 enum EdgeType {
     DIRECTIONAL, DIRECTIONAL_REVERSE, BIDIRECTIONAL   
 };
 
-template <class flow_t>
+// Adjacency is stored as CSR: the arcs of node u are
+// edges_[offset_[u] .. offset_[u+1]). Edges added with add_*_edge are
+// kept aside and sorted into place on first use. For big graphs the
+// two-phase builder avoids that: reserve_edges for every node, freeze,
+// then set_*_edge into the reserved slots, from several threads if
+// needed.
+//
+// cap_t stores residual capacities and may be narrower than flow_t, it
+// must hold the sum of both directions of any edge.
+//
+// max_flow polls the stop callback set with set_stop before every phase
+// and returns early once it says so. The residual graph stays valid, so
+// another max_flow call adds the rest of the flow.
+template <class flow_t, class cap_t = flow_t>
 class Dinic {
 public:
     Dinic() = delete;
@@ -20,86 +38,226 @@ public:
 
     void add_directional_edge(int u, int v, flow_t capacity);
     void add_bidirectional_edge(int u, int v, flow_t capacity);
+    // removes all edges, flow and the stop callback, allocations are
+    // kept for the next graph
+    void clear();
+
+    // two-phase construction
+    void reserve_edges(int node, int count);
+    void freeze();
+    // slots are indices among the edges reserved at u and v,
+    // every slot is set once and writes to different slots don't race
+    void set_directional_edge(int u, int u_slot, int v, int v_slot, flow_t capacity);
+    void set_bidirectional_edge(int u, int u_slot, int v, int v_slot, flow_t capacity);
 
     auto V() const -> int { return V_; }
 
+    // threads for bfs and partition, 0 = one thread per core
+    void set_threads(int threads) { threads_ = threads; }
+
     auto max_flow(int source, int sink) -> flow_t;
+    void set_stop(std::function<bool()> stop) { stop_ = std::move(stop); }
+    // the last max_flow call returned early
+    auto stopped() const -> bool { return stopped_; }
     // returns edges in minimum cut in form <capacity, <node_from, node_to>>
     auto min_cut(int source) -> std::vector<std::pair<int, int>>;
     // reachable=1 unreachable=0
     auto partition(int source) -> std::vector<bool>;
 
 private:
+    // 12 bytes, 16 before the type moved into rev_type; 16 bit
+    // capacities are padded to the same 12 bytes
     struct Edge {
         int node{};
-        int rev{};
-        flow_t capacity{};
-        EdgeType type{};
+        // index of the reverse edge, EdgeType in the top two bits
+        unsigned rev_type{};
+        cap_t capacity{};
 
-        Edge(int _node, int _rev, flow_t _capacity, EdgeType _type)
-            : node{_node}, rev{_rev}, capacity{_capacity}, type{_type} 
-        {}
+        auto rev() const -> int { return rev_type & rev_mask; }
+        auto type() const -> EdgeType { return static_cast<EdgeType>(rev_type >> 30); }
+    };
+
+    struct PendingEdge {
+        int u{};
+        int v{};
+        flow_t capacity{};
+        bool bidirectional{};
     };
 
     auto reverse_edge(const Edge& e) -> Edge& {
-        return adj_[e.node][e.rev];
+        return edges_[e.rev()];
     }
 
+    void set_edge(int u, int u_slot, int v, int v_slot, flow_t uv, flow_t vu, EdgeType type, EdgeType reverse_type);
     auto bfs(int source, int sink) -> bool;
-    auto dfs(int node, flow_t path_cap, int sink) -> flow_t;
+    // bfs distances from source over residual edges into level_,
+    // stops after the level of stop (-1 = visit everything)
+    void levels(int source, int stop);
+    void levels_parallel(int source, int stop);
+    void top_down_step(int depth);
+    void bottom_up_step(int depth);
+    auto visited(int node) const -> bool;
+    void prepare_pool();
+    // blocking flow in the level graph, at most limit
+    auto dfs(int source, int sink, flow_t limit) -> flow_t;
 
 private: 
     int V_ {};
     bool flow_called_ {false};
-    std::vector<std::vector<Edge>> adj_;
+    std::function<bool()> stop_;
+    bool stopped_ {false};
+    bool frozen_ {false};
+    std::vector<int> offset_;
+    std::vector<Edge> edges_;
+    // reserved slots per node while frozen_ is false, then filled slots
+    std::vector<int> reserved_;
+    std::vector<PendingEdge> pending_;
     std::vector<int> level_;
     std::vector<int> edge_id_;
+    // scratch kept between phases
+    std::vector<int> queue_;
+    std::vector<Edge*> path_;
+
+    int threads_ {1};
+    std::unique_ptr<ThreadPool> pool_;
+    // bitsets for the parallel bfs
+    std::vector<std::atomic<uint64_t>> visited_;
+    std::vector<std::atomic<uint64_t>> frontier_bits_;
+    std::vector<int> frontier_;
+    std::vector<std::vector<int>> local_;
 
     static constexpr flow_t flow_infty {std::numeric_limits<flow_t>::max()}; // /10;
     static constexpr int id_infty {std::numeric_limits<int>::max()};
     static constexpr int unvisited = -1;
     static constexpr int noparent = -2;
+    // smaller frontiers are expanded by the calling thread
+    static constexpr int parallel_frontier = 1024;
+    static constexpr unsigned rev_mask = (1u << 30) - 1;
 };
 
-template <class flow_t>
-Dinic<flow_t>::Dinic(int V) 
+template <class flow_t, class cap_t>
+Dinic<flow_t, cap_t>::Dinic(int V) 
     : V_ {V}
     , flow_called_ {false}
-    , adj_(V)
+    , offset_(V + 1)
+    , reserved_(V)
     , level_(V)
+    , edge_id_(V)
+    , queue_(V)
 { }
 
-template <class flow_t>
-void Dinic<flow_t>::add_directional_edge(int u, int v, flow_t capacity) {
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::add_directional_edge(int u, int v, flow_t capacity) {
     assert(0 <= std::min(u, v) && std::max(u, v) < V_);
     assert(capacity >= 0);
+    assert(!frozen_);
 
-    Edge uv {v, static_cast<int>(adj_[v].size()), capacity, DIRECTIONAL};
-    Edge vu {u, static_cast<int>(adj_[u].size()), 0, DIRECTIONAL_REVERSE};
-
-    adj_[u].push_back(uv);
-    adj_[v].push_back(vu);
+    pending_.push_back({u, v, capacity, false});
 }
 
-template <class flow_t>
-void Dinic<flow_t>::add_bidirectional_edge(int u, int v, flow_t capacity) {
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::add_bidirectional_edge(int u, int v, flow_t capacity) {
     assert(0 <= std::min(u, v) && std::max(u, v) < V_);
     assert(capacity >= 0);
-    Edge uv {v, static_cast<int>(adj_[v].size()), capacity, BIDIRECTIONAL};
-    Edge vu {u, static_cast<int>(adj_[u].size()), capacity, BIDIRECTIONAL};
+    assert(!frozen_);
+
+    pending_.push_back({u, v, capacity, true});
+}
+
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::clear() {
+    flow_called_ = false;
+    stop_ = nullptr;
+    stopped_ = false;
+    frozen_ = false;
+    std::fill(offset_.begin(), offset_.end(), 0);
+    edges_.clear();
+    std::fill(reserved_.begin(), reserved_.end(), 0);
+    pending_.clear();
+}
+
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::reserve_edges(int node, int count) {
+    assert(0 <= node && node < V_);
+    assert(!frozen_);
+    reserved_[node] += count;
+}
+
+// reserved slots come first, pending edges are placed after them
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::freeze() {
+    if (frozen_)
+        return;
+
+    for (auto& e : pending_) {
+        ++offset_[e.u + 1];
+        ++offset_[e.v + 1];
+    }
+    for (int node = 0; node != V_; ++node)
+        offset_[node + 1] += offset_[node] + reserved_[node];
+    edges_.resize(offset_[V_]);
+    assert(static_cast<unsigned>(offset_[V_]) <= rev_mask);
+
+    frozen_ = true;
+    for (auto& e : pending_) {
+        // reserved_ counts the slots in use from here on
+        int u_slot = reserved_[e.u]++;
+        int v_slot = reserved_[e.v]++;
+        if (e.bidirectional)
+            set_bidirectional_edge(e.u, u_slot, e.v, v_slot, e.capacity);
+        else
+            set_directional_edge(e.u, u_slot, e.v, v_slot, e.capacity);
+    }
+    pending_.clear();
+}
+
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::set_directional_edge(int u, int u_slot, int v, int v_slot, flow_t capacity) {
+    set_edge(u, u_slot, v, v_slot, capacity, 0, DIRECTIONAL, DIRECTIONAL_REVERSE);
+}
 
-    adj_[u].push_back(uv);
-    adj_[v].push_back(vu);
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::set_bidirectional_edge(int u, int u_slot, int v, int v_slot, flow_t capacity) {
+    set_edge(u, u_slot, v, v_slot, capacity, capacity, BIDIRECTIONAL, BIDIRECTIONAL);
 }
 
-template <class flow_t>
-auto Dinic<flow_t>::max_flow(int source, int sink) -> flow_t {
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::set_edge(
+        int u, int u_slot, int v, int v_slot, 
+        flow_t uv, flow_t vu, 
+        EdgeType type, EdgeType reverse_type) 
+{
+    assert(frozen_);
+    assert(0 <= std::min(u, v) && std::max(u, v) < V_);
+    assert(0 <= u_slot && u_slot < offset_[u + 1] - offset_[u]);
+    assert(0 <= v_slot && v_slot < offset_[v + 1] - offset_[v]);
+    assert(uv >= 0 && vu >= 0);
+    // residual of one direction grows up to the sum of both
+    assert(uv + vu <= std::numeric_limits<cap_t>::max());
+
+    int a = offset_[u] + u_slot;
+    int b = offset_[v] + v_slot;
+    edges_[a] = {v, b | unsigned(type) << 30, static_cast<cap_t>(uv)};
+    edges_[b] = {u, a | unsigned(reverse_type) << 30, static_cast<cap_t>(vu)};
+}
+
+template <class flow_t, class cap_t>
+auto Dinic<flow_t, cap_t>::max_flow(int source, int sink) -> flow_t {
     flow_t flow = 0;
  
     flow_t flow_cap = std::numeric_limits<flow_t>::max();
-    while (flow_cap > 0 and bfs(source, sink)) {
-        edge_id_.assign(V_, 0);
-        flow_t increment = dfs(source, flow_cap, sink);
+    freeze();
+    prepare_pool();
+    stopped_ = false;
+    while (flow_cap > 0) {
+        if (stop_ and stop_()) {
+            stopped_ = true;
+            break;
+        }
+        if (!bfs(source, sink))
+            break;
+        std::copy(offset_.begin(), offset_.end() - 1, edge_id_.begin());
+        flow_t increment = dfs(source, sink, flow_cap);
         assert(increment > 0);
         flow += increment;
         flow_cap -= increment;
@@ -109,8 +267,8 @@ auto Dinic<flow_t>::max_flow(int source, int sink) -> flow_t {
     return flow;    
 }
 
-template <class flow_t>
-auto Dinic<flow_t>::min_cut(int source) -> std::vector<std::pair<int, int>> {
+template <class flow_t, class cap_t>
+auto Dinic<flow_t, cap_t>::min_cut(int source) -> std::vector<std::pair<int, int>> {
     assert(flow_called_);
 
     auto reachable = partition(source);
@@ -118,86 +276,242 @@ auto Dinic<flow_t>::min_cut(int source) -> std::vector<std::pair<int, int>> {
     std::vector<std::pair<int, int>> cut;
 
     for (int node = 0; node < V_; node++)
-        for (auto& e : adj_[node])
-            if (reachable[node] && !reachable[e.node] && e.type != DIRECTIONAL_REVERSE) {
+        for (int id = offset_[node]; id != offset_[node + 1]; ++id) {
+            auto& e = edges_[id];
+            if (reachable[node] && !reachable[e.node] && e.type() != DIRECTIONAL_REVERSE) {
                 cut.push_back({node, e.node});
             }
+        }
 
     return cut;
 }
 
-template <class flow_t>
-auto Dinic<flow_t>::partition(int source) -> std::vector<bool> {
+template <class flow_t, class cap_t>
+auto Dinic<flow_t, cap_t>::partition(int source) -> std::vector<bool> {
     assert(flow_called_);
 
+    prepare_pool();
+    levels(source, -1);
+
     std::vector<bool> partition(V_, false); 
-    partition[source] = true;
-
-    std::stack<int> st;
-    st.push(source);
-    while (!st.empty()) {
-        auto cur = st.top();
-        st.pop();
-        for (auto& e : adj_[cur]) {
-            if (e.capacity > 0 and !partition[e.node]) {
-                partition[e.node] = true;
-                st.push(e.node);
-            }
-        }
-    }
+    for (int node = 0; node != V_; ++node)
+        partition[node] = level_[node] < id_infty;
     
     return partition;
 }
 
-template <class flow_t>
-auto Dinic<flow_t>::bfs(int source, int sink) -> bool {
-    std::vector<int> q(V_); 
-    int q_start = 0, q_end = 0;
-    level_.assign(V_, id_infty);
+template <class flow_t, class cap_t>
+auto Dinic<flow_t, cap_t>::bfs(int source, int sink) -> bool {
+    levels(source, sink);
+    return level_[sink] < id_infty;
+}
 
-    auto bfs_check = [&](int node, int new_dist) -> void {
-        if (new_dist < level_[node]) {
-            level_[node] = new_dist;
-            q[q_end++] = node;
-        }
-    };
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::levels(int source, int stop) {
+    if (pool_ and pool_->size() > 1)
+        return levels_parallel(source, stop);
 
-    bfs_check(source, 0);
+    int q_start = 0, q_end = 0;
+    std::fill(level_.begin(), level_.end(), id_infty);
+
+    level_[source] = 0;
+    queue_[q_end++] = source;
 
     while (q_start < q_end) {
-        int top = q[q_start++];
+        int top = queue_[q_start++];
+        // nodes at the sink level or deeper are never on a shortest path
+        if (stop >= 0 and level_[top] >= level_[stop])
+            break;
 
-        for (Edge &e : adj_[top])
-            if (e.capacity > 0)
-                bfs_check(e.node, level_[top] + 1);
+        for (int id = offset_[top]; id != offset_[top + 1]; ++id) {
+            auto& e = edges_[id];
+            if (e.capacity > 0 and level_[e.node] == id_infty) {
+                level_[e.node] = level_[top] + 1;
+                queue_[q_end++] = e.node;
+            }
+        }
     }
+}
 
-    return level_[sink] < id_infty;
+// Direction-optimizing bfs (Beamer et al.): small frontiers push to
+// their neighbours, big ones let every unvisited node look for a parent
+// in the frontier, which needs no atomics and touches each edge once.
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::levels_parallel(int source, int stop) {
+    pool_->parallel_for(V_, [&](int begin, int end, int) {
+        std::fill(level_.begin() + begin, level_.begin() + end, id_infty);
+    });
+    pool_->parallel_for(visited_.size(), [&](int begin, int end, int) {
+        for (int w = begin; w != end; ++w)
+            visited_[w].store(0, std::memory_order_relaxed);
+    });
+
+    level_[source] = 0;
+    visited_[source / 64].fetch_or(uint64_t{1} << (source % 64), std::memory_order_relaxed);
+    frontier_.assign(1, source);
+
+    bool bottom_up = false;
+    for (int depth = 0; !frontier_.empty(); ++depth) {
+        if (stop >= 0 and visited(stop))
+            break;
+
+        const int size = frontier_.size();
+        if (!bottom_up and size > V_ / 14)
+            bottom_up = true;
+        else if (bottom_up and size < V_ / 24)
+            bottom_up = false;
+
+        if (bottom_up)
+            bottom_up_step(depth);
+        else
+            top_down_step(depth);
+
+        frontier_.clear();
+        for (auto& local : local_) {
+            frontier_.insert(frontier_.end(), local.begin(), local.end());
+            local.clear();
+        }
+    }
 }
 
-template <class flow_t>
-auto Dinic<flow_t>::dfs(int node, flow_t path_cap, int sink) -> flow_t {
-    if (node == sink)
-        return path_cap;
-    if (level_[node] >= level_[sink])
-        return 0;
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::top_down_step(int depth) {
+    auto expand = [&](int begin, int end, int t) {
+        auto& out = local_[t];
+        for (int i = begin; i != end; ++i) {
+            const int node = frontier_[i];
+            for (int id = offset_[node]; id != offset_[node + 1]; ++id) {
+                auto& e = edges_[id];
+                if (e.capacity == 0 or visited(e.node))
+                    continue;
+                uint64_t bit = uint64_t{1} << (e.node % 64);
+                if (visited_[e.node / 64].fetch_or(bit, std::memory_order_relaxed) & bit)
+                    continue;
+                level_[e.node] = depth + 1;
+                out.push_back(e.node);
+            }
+        }
+    };
 
+    if (int(frontier_.size()) < parallel_frontier)
+        expand(0, frontier_.size(), 0);
+    else
+        pool_->parallel_for(frontier_.size(), expand);
+}
+
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::bottom_up_step(int depth) {
+    pool_->parallel_for(frontier_bits_.size(), [&](int begin, int end, int) {
+        for (int w = begin; w != end; ++w)
+            frontier_bits_[w].store(0, std::memory_order_relaxed);
+    });
+    pool_->parallel_for(frontier_.size(), [&](int begin, int end, int) {
+        for (int i = begin; i != end; ++i) {
+            int node = frontier_[i];
+            frontier_bits_[node / 64].fetch_or(uint64_t{1} << (node % 64), std::memory_order_relaxed);
+        }
+    });
+
+    // chunks of whole words, so every visited_ word has one writer
+    pool_->parallel_for(visited_.size(), [&](int begin, int end, int t) {
+        auto& out = local_[t];
+        for (int w = begin; w != end; ++w) {
+            uint64_t word = visited_[w].load(std::memory_order_relaxed);
+            if (~word == 0)
+                continue;
+            for (int node = w * 64; node != std::min(V_, w * 64 + 64); ++node) {
+                if (word >> (node % 64) & 1)
+                    continue;
+                for (int id = offset_[node]; id != offset_[node + 1]; ++id) {
+                    auto& e = edges_[id];
+                    if (reverse_edge(e).capacity == 0)
+                        continue;
+                    if (!(frontier_bits_[e.node / 64].load(std::memory_order_relaxed) >> (e.node % 64) & 1))
+                        continue;
+                    level_[node] = depth + 1;
+                    word |= uint64_t{1} << (node % 64);
+                    out.push_back(node);
+                    break;
+                }
+            }
+            visited_[w].store(word, std::memory_order_relaxed);
+        }
+    });
+}
+
+template <class flow_t, class cap_t>
+auto Dinic<flow_t, cap_t>::visited(int node) const -> bool {
+    return visited_[node / 64].load(std::memory_order_relaxed) >> (node % 64) & 1;
+}
+
+template <class flow_t, class cap_t>
+void Dinic<flow_t, cap_t>::prepare_pool() {
+    if (threads_ == 1) {
+        pool_.reset();
+        return;
+    }
+    if (!pool_ or (threads_ > 0 and pool_->size() != threads_))
+        pool_ = std::make_unique<ThreadPool>(threads_);
+
+    local_.resize(pool_->size());
+    const size_t words = (V_ + 63) / 64;
+    if (visited_.size() != words) {
+        visited_ = std::vector<std::atomic<uint64_t>>(words);
+        frontier_bits_ = std::vector<std::atomic<uint64_t>>(words);
+    }
+}
+
+// iterative, the current path is kept in path_ so long paths
+// through big grids don't hit the stack limit
+template <class flow_t, class cap_t>
+auto Dinic<flow_t, cap_t>::dfs(int source, int sink, flow_t limit) -> flow_t {
     flow_t flow{};
+    path_.clear();
+    int node = source;
+
+    while (flow < limit) {
+        if (node == sink) {
+            flow_t path_cap = limit - flow;
+            for (auto* e : path_)
+                path_cap = std::min(path_cap, static_cast<flow_t>(e->capacity));
+
+            // retreat to the tail of the first saturated edge
+            const int length = path_.size();
+            int saturated = length;
+            for (int i = 0; i != length; ++i) {
+                auto& e = *path_[i];
+                e.capacity -= path_cap;
+                reverse_edge(e).capacity += path_cap;
+                if (e.capacity == 0 and saturated == length)
+                    saturated = i;
+            }
+            flow += path_cap;
+            path_.resize(saturated);
+            node = path_.empty() ? source : path_.back()->node;
+            continue;
+        }
 
-    while (edge_id_[node] < int(adj_[node].size())) {
-        auto& e = adj_[node][edge_id_[node]];
+        const int end = offset_[node + 1];
+        auto& id = edge_id_[node];
+        for (; id != end; ++id) {
+            auto& e = edges_[id];
+            if (e.capacity > 0 
+                    and level_[node] + 1 == level_[e.node] 
+                    and (e.node == sink or level_[e.node] < level_[sink]))
+                break;
+        }
 
-        if (e.capacity > 0 && level_[node] + 1 == level_[e.node]) {
-            flow_t path = dfs(e.node, std::min(path_cap, e.capacity), sink);
-            path_cap -= path;
-            e.capacity -= path;
-            reverse_edge(e).capacity += path;
-            flow += path;
+        if (id != end) {
+            path_.push_back(&edges_[id]);
+            node = edges_[id].node;
+            continue;
         }
 
-        if (path_cap == 0)
+        // dead end
+        if (path_.empty())
             break;
-
+        path_.pop_back();
+        node = path_.empty() ? source : path_.back()->node;
         edge_id_[node]++;
     }
 
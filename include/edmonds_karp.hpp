@@ -4,9 +4,14 @@
 #include <queue>
 #include <algorithm>
 #include <limits>
-#include <stack>
 #include <cassert>
+#include <functional>
 
+#include "dinic.hpp"
+
+// residual edges are stored in pairs like in Dinic,
+// memory is linear in the number of edges, the stop callback is polled
+// before every augmenting path
 template <class flow_t>
 class EdmondsKarp {
 public:
@@ -16,26 +21,50 @@ public:
 
     void add_directional_edge(int u, int v, flow_t capacity);
     void add_bidirectional_edge(int u, int v, flow_t capacity);
+    // removes all edges, flow and the stop callback, adjacency lists
+    // keep their memory
+    void clear();
 
     auto max_flow(int source, int sink) -> flow_t;
+    void set_stop(std::function<bool()> stop) { stop_ = std::move(stop); }
+    // the last max_flow call returned early
+    auto stopped() const -> bool { return stopped_; }
     // returns edges in minimum cut in form <capacity, <node_from, node_to>>
     auto min_cut(int source) -> std::vector<std::pair<int, int>>;
     // reachable=1 unreachable=0
-    auto partition(int source) -> std::vector<int>;
+    auto partition(int source) -> std::vector<bool>;
 
     int V() const {return V_;}
 
 private:
+    struct Edge {
+        int node{};
+        int rev{};
+        flow_t capacity{};
+        EdgeType type{};
+
+        Edge(int _node, int _rev, flow_t _capacity, EdgeType _type)
+            : node{_node}, rev{_rev}, capacity{_capacity}, type{_type} 
+        {}
+    };
+
+    auto reverse_edge(const Edge& e) -> Edge& {
+        return adj_[e.node][e.rev];
+    }
+
     auto bfs(int source, int sink) -> flow_t;
 
-    // TODO: capacity can possible be stored in adj with struct::edges
 private: 
     int V_ {};
     bool flow_called_ {false};
+    std::function<bool()> stop_;
+    bool stopped_ {false};
 
-    std::vector<std::vector<int>> adj_;
-    std::vector<std::vector<flow_t>> capacity_;
+    std::vector<std::vector<Edge>> adj_;
+    // node the bfs came from and the index of the edge in its list
     std::vector<int> parent_;
+    std::vector<int> parent_edge_;
+    std::vector<int> queue_;
 
     static constexpr flow_t flow_infty {std::numeric_limits<flow_t>::max()}; // /10;
     static constexpr int unvisited = -1;
@@ -47,31 +76,42 @@ EdmondsKarp<flow_t>::EdmondsKarp(int V)
     : V_ {V}
     , flow_called_ {false}
     , adj_ (V_)
-    , capacity_ (V_, std::vector<flow_t>(V_))
     , parent_ (V_)
+    , parent_edge_ (V_)
+    , queue_ (V_)
 { }
 
+template <class flow_t>
+void EdmondsKarp<flow_t>::clear() {
+    flow_called_ = false;
+    stop_ = nullptr;
+    stopped_ = false;
+    for (auto& edges : adj_)
+        edges.clear();
+}
+
 template <class flow_t>
 void EdmondsKarp<flow_t>::add_directional_edge(int u, int v, flow_t capacity) {
     assert(0 <= std::min(u, v) && std::max(u, v) < V_);
     assert(capacity >= 0);
-    if (capacity_[u][v]) {
-        capacity_[u][v] += capacity;
-        return;
-    }
-    adj_[u].push_back(v);
-    adj_[v].push_back(u);
-    capacity_[u][v] = capacity;
+
+    Edge uv {v, static_cast<int>(adj_[v].size()), capacity, DIRECTIONAL};
+    Edge vu {u, static_cast<int>(adj_[u].size()), 0, DIRECTIONAL_REVERSE};
+
+    adj_[u].push_back(uv);
+    adj_[v].push_back(vu);
 }
 
 template <class flow_t>
 void EdmondsKarp<flow_t>::add_bidirectional_edge(int u, int v, flow_t capacity) {
     assert(0 <= std::min(u, v) && std::max(u, v) < V_);
     assert(capacity >= 0);
-    adj_[u].push_back(v);
-    adj_[v].push_back(u);
-    capacity_[u][v] = capacity;
-    capacity_[v][u] = capacity;
+
+    Edge uv {v, static_cast<int>(adj_[v].size()), capacity, BIDIRECTIONAL};
+    Edge vu {u, static_cast<int>(adj_[u].size()), capacity, BIDIRECTIONAL};
+
+    adj_[u].push_back(uv);
+    adj_[v].push_back(vu);
 }
 
 template <class flow_t>
@@ -79,13 +119,15 @@ auto EdmondsKarp<flow_t>::max_flow(int source, int sink) -> flow_t {
     flow_t flow = 0;
  
     flow_t augm_flow = 0;
-    while ((augm_flow = bfs(source, sink))) {
+    stopped_ = false;
+    while (!(stop_ and (stopped_ = stop_())) and (augm_flow = bfs(source, sink))) {
         flow += augm_flow;
         auto to = sink;
         while (to != source) {
             auto from = parent_[to];
-            capacity_[from][to] -= augm_flow;
-            capacity_[to][from] += augm_flow;
+            auto& e = adj_[from][parent_edge_[to]];
+            e.capacity -= augm_flow;
+            reverse_edge(e).capacity += augm_flow;
             to = from;
         }
     }
@@ -102,9 +144,9 @@ auto EdmondsKarp<flow_t>::min_cut(int source) -> std::vector<std::pair<int, int>
     bfs(source, -3); // -3 is never reachable
                      
     for (int u = 0; u < V_; ++u) {
-        for (auto v : adj_[u]) {
-            if (parent_[u] != unvisited and parent_[v] == unvisited) {
-                cut.push_back({u, v});
+        for (auto& e : adj_[u]) {
+            if (parent_[u] != unvisited and parent_[e.node] == unvisited and e.type != DIRECTIONAL_REVERSE) {
+                cut.push_back({u, e.node});
             }
         }
     }
@@ -113,47 +155,46 @@ auto EdmondsKarp<flow_t>::min_cut(int source) -> std::vector<std::pair<int, int>
 }
 
 template <class flow_t>
-auto EdmondsKarp<flow_t>::partition(int source) -> std::vector<int> {
+auto EdmondsKarp<flow_t>::partition(int source) -> std::vector<bool> {
     assert(flow_called_);
 
     bfs(source, -3);
-    std::vector<int> partition(V_);
+    std::vector<bool> partition(V_);
     for (int i = 0; i != V_; ++i) {
-        if (parent_[i] == unvisited) {
-            partition[i] = 0;
-        }
-        else {
-            partition[i] = 255;
-        }
+        partition[i] = parent_[i] != unvisited;
     }
 
     return partition;
 }
+
 template <class flow_t>
 auto EdmondsKarp<flow_t>::bfs(int source, int sink) -> flow_t {
     std::fill(begin(parent_), end(parent_), unvisited);
     parent_[source] = noparent;
 
-    std::queue<std::pair<int, flow_t>> q;
-    q.push({source, flow_infty});
+    int q_start = 0, q_end = 0;
+    queue_[q_end++] = source;
  
-    while (!q.empty()) {
-        auto [from, from_flow] = q.front();
-        q.pop();
+    while (q_start < q_end) {
+        auto from = queue_[q_start++];
 
-        for (auto to : adj_[from]) {
-            if (parent_[to] != unvisited or capacity_[from][to] == 0)
+        for (int id = 0; id != int(adj_[from].size()); ++id) {
+            auto& e = adj_[from][id];
+            if (parent_[e.node] != unvisited or e.capacity == 0)
                 continue;
 
-            parent_[to] = from;
-            auto to_flow = std::min(from_flow, capacity_[from][to]);
-            if (to == sink) {
-                return to_flow;
+            parent_[e.node] = from;
+            parent_edge_[e.node] = id;
+            if (e.node == sink) {
+                // bottleneck of the path
+                flow_t path_flow = flow_infty;
+                for (int to = sink; to != source; to = parent_[to])
+                    path_flow = std::min(path_flow, adj_[parent_[to]][parent_edge_[to]].capacity);
+                return path_flow;
             }
-            q.push({to, to_flow});
+            queue_[q_end++] = e.node;
         }
     }
     
     return 0;
 }
-
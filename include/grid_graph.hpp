@@ -0,0 +1,241 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <type_traits>
+#include <cassert>
+
+// Implicit 4-connected pixel grid.
+// Nodes 0..pixels-1 are pixels in raster order, source() and sink() are
+// the two terminals. Residual capacities are kept in flat per-direction
+// planes and terminal capacities in two more planes, neighbours are
+// computed from the node index.
+//
+// Arc ids are node*4 + direction. The grid is closed into a torus by
+// zero capacity seam arcs, so every arc has a sister and no bound checks
+// are needed when walking over neighbours.
+template <class flow_t>
+class GridGraph {
+public:
+    enum Direction {
+        RIGHT, LEFT, DOWN, UP
+    };
+
+    GridGraph() = delete;
+    GridGraph(int height, int width);
+    ~GridGraph() = default;
+
+    auto height() const -> int { return height_; }
+    auto width() const -> int { return width_; }
+    auto pixels() const -> int { return pixels_; }
+    auto V() const -> int { return pixels_ + 2; }
+    auto source() const -> int { return pixels_; }
+    auto sink() const -> int { return pixels_ + 1; }
+
+    // edge between node and node+1
+    void set_horizontal(int node, flow_t capacity);
+    // edge between node and node+width
+    void set_vertical(int node, flow_t capacity);
+    void add_source_capacity(int node, flow_t capacity);
+    void add_sink_capacity(int node, flow_t capacity);
+    // all capacities back to 0
+    void clear();
+
+    // same surface as Dinic, edges must follow the grid topology
+    void add_directional_edge(int u, int v, flow_t capacity);
+    void add_bidirectional_edge(int u, int v, flow_t capacity);
+
+    auto plane(Direction dir) -> std::vector<flow_t>& { return planes_[dir]; }
+    auto source_plane() -> std::vector<flow_t>& { return source_; }
+    auto sink_plane() -> std::vector<flow_t>& { return sink_; }
+
+    static auto arc(int node, Direction dir) -> int { return node * 4 + dir; }
+    auto first_arc(int node) const -> int { return node < pixels_ ? node * 4 : noarc; }
+    static auto next_arc(int a) -> int { return (a & 3) == 3 ? noarc : a + 1; }
+    auto head(int a) const -> int;
+    auto sister(int a) const -> int { return head(a) * 4 + ((a & 3) ^ 1); }
+    auto capacity(int a) -> flow_t& { return planes_[a & 3][a >> 2]; }
+    auto capacity(int a) const -> flow_t { return planes_[a & 3][a >> 2]; }
+
+    auto fold_terminals(int source, int sink, std::vector<flow_t>& tr_cap) -> flow_t;
+
+    // returns edges in minimum cut in form <node_from, node_to>
+    auto min_cut(const std::vector<bool>& reachable) const -> std::vector<std::pair<int, int>>;
+
+    static constexpr int noarc = -1;
+
+private:
+    auto direction(int u, int v) const -> Direction;
+    auto is_seam(int a) const -> bool;
+
+private:
+    int height_ {};
+    int width_ {};
+    int pixels_ {};
+    std::array<int, 4> offset_ {};
+
+    std::array<std::vector<flow_t>, 4> planes_;
+    std::vector<flow_t> source_;
+    std::vector<flow_t> sink_;
+};
+
+template <class T>
+struct is_grid_graph : std::false_type {};
+template <class flow_t>
+struct is_grid_graph<GridGraph<flow_t>> : std::true_type {};
+
+// true for solvers that keep their graph in GridGraph storage
+template <class solver_t, class = void>
+struct runs_on_grid : std::false_type {};
+template <class solver_t>
+struct runs_on_grid<solver_t, std::void_t<typename solver_t::graph_type>>
+    : is_grid_graph<typename solver_t::graph_type> {};
+template <class solver_t>
+inline constexpr bool runs_on_grid_v = runs_on_grid<solver_t>::value;
+
+template <class flow_t>
+GridGraph<flow_t>::GridGraph(int height, int width)
+    : height_ {height}
+    , width_ {width}
+    , pixels_ {height * width}
+    , offset_ {1, -1, width, -width}
+    , source_(pixels_, 0)
+    , sink_(pixels_, 0)
+{
+    assert(height > 0 && width > 0);
+    for (auto& plane : planes_)
+        plane.assign(pixels_, 0);
+}
+
+template <class flow_t>
+void GridGraph<flow_t>::clear() {
+    for (auto& plane : planes_)
+        std::fill(plane.begin(), plane.end(), 0);
+    std::fill(source_.begin(), source_.end(), 0);
+    std::fill(sink_.begin(), sink_.end(), 0);
+}
+
+template <class flow_t>
+void GridGraph<flow_t>::set_horizontal(int node, flow_t capacity) {
+    assert(0 <= node && node + 1 < pixels_ && (node + 1) % width_);
+    assert(capacity >= 0);
+    planes_[RIGHT][node] = capacity;
+    planes_[LEFT][node + 1] = capacity;
+}
+
+template <class flow_t>
+void GridGraph<flow_t>::set_vertical(int node, flow_t capacity) {
+    assert(0 <= node && node + width_ < pixels_);
+    assert(capacity >= 0);
+    planes_[DOWN][node] = capacity;
+    planes_[UP][node + width_] = capacity;
+}
+
+template <class flow_t>
+void GridGraph<flow_t>::add_source_capacity(int node, flow_t capacity) {
+    assert(0 <= node && node < pixels_);
+    assert(capacity >= 0);
+    source_[node] += capacity;
+}
+
+template <class flow_t>
+void GridGraph<flow_t>::add_sink_capacity(int node, flow_t capacity) {
+    assert(0 <= node && node < pixels_);
+    assert(capacity >= 0);
+    sink_[node] += capacity;
+}
+
+template <class flow_t>
+void GridGraph<flow_t>::add_directional_edge(int u, int v, flow_t capacity) {
+    assert(0 <= std::min(u, v) && std::max(u, v) < V());
+    assert(capacity >= 0);
+
+    if (u == source() and v != sink())
+        return add_source_capacity(v, capacity);
+    if (v == sink() and u != source())
+        return add_sink_capacity(u, capacity);
+
+    auto dir = direction(u, v);
+    planes_[dir][u] += capacity;
+}
+
+template <class flow_t>
+void GridGraph<flow_t>::add_bidirectional_edge(int u, int v, flow_t capacity) {
+    assert(0 <= std::min(u, v) && std::max(u, v) < pixels_);
+    assert(capacity >= 0);
+
+    auto dir = direction(u, v);
+    planes_[dir][u] += capacity;
+    planes_[dir ^ 1][v] += capacity;
+}
+
+template <class flow_t>
+auto GridGraph<flow_t>::head(int a) const -> int {
+    int node = (a >> 2) + offset_[a & 3];
+    if (node < 0)
+        return node + pixels_;
+    if (node >= pixels_)
+        return node - pixels_;
+    return node;
+}
+
+template <class flow_t>
+auto GridGraph<flow_t>::fold_terminals(int source, int sink, std::vector<flow_t>& tr_cap) -> flow_t {
+    assert(source == this->source() && sink == this->sink());
+
+    flow_t flow = 0;
+    tr_cap.assign(V(), 0);
+    for (int node = 0; node != pixels_; ++node) {
+        flow += std::min(source_[node], sink_[node]);
+        tr_cap[node] = source_[node] - sink_[node];
+    }
+
+    return flow;
+}
+
+template <class flow_t>
+auto GridGraph<flow_t>::min_cut(const std::vector<bool>& reachable) const -> std::vector<std::pair<int, int>> {
+    std::vector<std::pair<int, int>> cut;
+
+    for (int node = 0; node != pixels_; ++node) {
+        if (source_[node] > 0 and !reachable[node])
+            cut.push_back({source(), node});
+        if (!reachable[node])
+            continue;
+        for (int a = first_arc(node); a != noarc; a = next_arc(a))
+            if (!is_seam(a) and !reachable[head(a)])
+                cut.push_back({node, head(a)});
+        if (sink_[node] > 0)
+            cut.push_back({node, sink()});
+    }
+
+    return cut;
+}
+
+template <class flow_t>
+auto GridGraph<flow_t>::direction(int u, int v) const -> Direction {
+    if (v == u + 1 and v % width_)
+        return RIGHT;
+    if (v == u - 1 and u % width_)
+        return LEFT;
+    if (v == u + width_)
+        return DOWN;
+    assert(v == u - width_ && "edge does not follow the grid topology");
+    return UP;
+}
+
+template <class flow_t>
+auto GridGraph<flow_t>::is_seam(int a) const -> bool {
+    int node = a >> 2;
+    switch (a & 3) {
+    case RIGHT:
+        return (node + 1) % width_ == 0;
+    case LEFT:
+        return node % width_ == 0;
+    case DOWN:
+        return node + width_ >= pixels_;
+    default:
+        return node < width_;
+    }
+}
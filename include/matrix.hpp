@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string_view>
+#include <array>
 #include <iostream>
 #include <vector>
 #include <algorithm>
@@ -42,6 +43,7 @@ public:
 
     auto operator=(const Matrix<scalar_t>& b) -> Matrix<scalar_t>&;
     auto copy() const -> Matrix<scalar_t>;
+    void swap(Matrix<scalar_t>& b);
 
     void reset(size_t height, size_t width, size_t channels, scalar_t val = 0);
     void reset(Shape new_shape, scalar_t val = 0);
@@ -109,6 +111,12 @@ auto Matrix<scalar_t>::copy() const -> Matrix<scalar_t> {
     return {*this};
 }
 
+template <class scalar_t>
+void Matrix<scalar_t>::swap(Matrix<scalar_t>& b) {
+    data_.swap(b.data_);
+    std::swap(shape_, b.shape_);
+}
+
 template <class scalar_t>
 void Matrix<scalar_t>::reset(size_t height, size_t width, size_t channels, scalar_t val) {
     auto new_size = height * width * channels;
@@ -2,45 +2,398 @@
 
 #include "matrix.hpp"
 #include "dinic.hpp"
+#include "boykov_kolmogorov.hpp"
+#include "grid_graph.hpp"
+#include "thread_pool.hpp"
 
 #include <unordered_set>
+#include <unordered_map>
 #include <vector>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
 #include <cmath>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+
+enum class Solver {
+    DINIC, EDMONDS_KARP, BOYKOV_KOLMOGOROV, PUSH_RELABEL
+};
+
+// accepts dinic, ek, bk, pr
+auto parse_solver(std::string_view name) -> std::optional<Solver>;
+auto solver_name(Solver solver) -> std::string_view;
+
+// how pixels are numbered as graph nodes
+enum class NodeOrder {
+    RASTER, TILED, MORTON
+};
+
+// accepts raster, tiled, morton
+auto parse_node_order(std::string_view name) -> std::optional<NodeOrder>;
+// graph node of every pixel
+auto node_numbering(int height, int width, NodeOrder order) -> std::vector<int>;
 
 class Painter {
 public:   
     Painter() = delete;
     Painter(const char* filename, int terminal_capacity = 23);
-    ~Painter() = default;
+    ~Painter();
 
     auto drawing() const -> const Matrix<unsigned char>&;
     bool empty() const;
 
+    auto solver() const -> Solver { return solver_; }
+    void set_solver(Solver solver) { solver_ = solver; }
+    // threads for parallel solvers, 0 = one per core
+    void set_threads(int threads) { threads_ = threads; }
+    // keeps one Boykov-Kolmogorov graph per color between paint calls and
+    // repairs the previous flow where scribbles changed, other solvers
+    // always paint from scratch. Off by default: a kept graph costs about
+    // 50 bytes per pixel and repairing it scans every pixel, so only the
+    // first four colors keep theirs. Ignored while any other paint mode
+    // below is on
+    auto incremental() const -> bool { return incremental_; }
+    void set_incremental(bool incremental);
+    // node layout for Dinic, Edmonds-Karp and BoykovKolmogorov<int>,
+    // grid solvers keep their own raster storage
+    void set_node_order(NodeOrder order) { node_order_ = order; }
+    // segments all scribble colors at once with alpha-expansion on a Potts
+    // energy instead of one cut per color, solved with Boykov-Kolmogorov.
+    // Every move cuts the whole image, so each label expands once instead
+    // of until the energy stops falling, and the mode still trades
+    // several times the time of paint for consistent labels: colors don't
+    // override each other, a region both a color and its neighbour could
+    // take goes to the cheaper one, where paint may leave it unpainted or
+    // give it to the later color. Paint modes
+    // are tried in the order multi-label, regions, pyramid, tiles,
+    // superpixels, incremental and the first one on paints; multi-label
+    // overrides all others and ignores set_solver
+    auto multi_label() const -> bool { return multi_label_; }
+    void set_multi_label(bool multi_label) { multi_label_ = multi_label; }
+    // pixels darker than threshold split the drawing into regions,
+    // regions with one scribble color are filled without a cut and the
+    // rest is solved region by region in parallel, 0 = off. Regions are
+    // always cut with Boykov-Kolmogorov on a grid, whatever the solver.
+    // Only multi-label takes precedence
+    void set_stroke_threshold(int threshold) { stroke_threshold_ = threshold; }
+    // solves on a pyramid halved levels times and refines only a band
+    // around the label boundaries at every finer level, 0 = off. Ignored
+    // with multi-label or regions on, overrides tiles, superpixels and
+    // incremental. Every level is cut with Boykov-Kolmogorov on a graph
+    // of arcs and set_solver is ignored
+    void set_pyramid_levels(int levels) { pyramid_levels_ = levels; }
+    // solves a coarse pass of the image halved until it fits a few tiles,
+    // then re-solves every finer level in overlapping tiles of this size
+    // in parallel until they agree, 0 = off. Ignored with multi-label,
+    // regions or pyramid on, overrides superpixels and incremental. Tiles
+    // are cut with Boykov-Kolmogorov on a graph of arcs, not set_solver
+    void set_tile_size(int tile_size) { tile_size_ = tile_size; }
+    // contracts the drawing to watershed superpixels grown from a grid
+    // with this spacing, cuts the contracted graph and refines a band
+    // around its label boundaries per pixel, 0 = off. Only incremental
+    // and the plain solvers give way to it. Both the contracted graph and
+    // the band use Boykov-Kolmogorov on arcs, whatever set_solver picks
+    void set_superpixel_size(int size) { superpixel_size_ = size; }
+    // scribble colors closer than tolerance in every channel merge into
+    // the most used one before painting, 0 = exact colors only
+    void set_color_tolerance(int tolerance) { color_tolerance_ = tolerance; }
+    // merged colors with fewer scribble pixels are dropped, 0 = keep all
+    void set_min_color_pixels(int pixels) { min_color_pixels_ = pixels; }
+    // at most this many colors and cuts per paint, the least used colors
+    // join their closest kept one, 0 = no limit. White scribbles, which
+    // leave pixels unpainted, are never merged, dropped or counted
+    void set_max_colors(int colors) { max_colors_ = colors; }
+    // after a first full paint, later paints re-solve only boxes around
+    // the previous regions with changed scribbles, grown by margin pixels,
+    // other labels stay fixed, 0 = off. Boxes are re-solved with
+    // sequential cuts, so paints with multi-label, regions or superpixels
+    // on always paint everything
+    void set_repaint_margin(int margin);
+
+    // paints with the max-flow solver selected by set_solver
     void paint(Matrix<unsigned char>& scribbles);
+    // like paint but only fills labels(), drawing() keeps the last paint
+    void segment(Matrix<unsigned char>& scribbles);
+    // color of every pixel as an index into palette(), unlabeled for
+    // pixels left to the drawing, written by every paint mode
+    static constexpr std::uint16_t unlabeled = 0xffff;
+    auto labels() const -> const std::vector<std::uint16_t>& { return labels_; }
+    auto palette() const -> const std::vector<std::array<u_char, 3>>& { return palette_; }
+    // graph_t is Dinic<int>, Dinic<int, uint16_t>, EdmondsKarp<int>, BoykovKolmogorov<int>,
+    // BoykovKolmogorov<int, GridGraph<int>> or PushRelabel<int, GridGraph<int>>
+    template <class graph_t>
+    void paint_with(Matrix<unsigned char>& scribbles);
+    // fast approximate paint for previews, every pixel takes the color of
+    // the closest scribble along paths that avoid strokes. The next paint
+    // still repaints from the last one
+    void preview(Matrix<unsigned char>& scribbles);
+    // paints within budget, exact cuts while time lasts and geodesic
+    // fill for the colors left, returns the pixels that are exact
+    auto paint_within(
+            Matrix<unsigned char>& scribbles,
+            std::chrono::milliseconds budget) -> std::vector<bool>;
+    // paints a copy of scribbles like paint on a worker thread, cancels
+    // a paint still running first. progress runs on the worker with the
+    // colors done after every sequential cut and once at the end, cuts
+    // also publish a snapshot. No other calls until paint_done().
+    void paint_async(
+            const Matrix<unsigned char>& scribbles,
+            std::function<void(int done, int colors)> progress = {});
+    // stops the running paint at its next solver poll or color and waits
+    void cancel_paint();
+    // waits for the running paint to finish
+    void wait_paint();
+    auto paint_done() const -> bool { return !working_; }
+    // runs read on the newest snapshot if it is newer than version, which
+    // is updated, a new snapshot waits for read to return
+    bool read_snapshot(
+            int& version,
+            const std::function<void(const Matrix<unsigned char>&)>& read);
+    // loads the next frame of a sequence and paints it from the labels of
+    // the current one, only pixels near moved line art or near scribbles
+    // that disagree with those labels are re-solved. Returns false if the
+    // frame can't be loaded, or if the scribbles are not of its size,
+    // which leaves the frame loaded and unpainted
+    auto paint_next_frame(
+            const char* filename,
+            Matrix<unsigned char>& scribbles) -> bool;
     auto imread(const char* filename) -> bool;
     auto imwrite(const std::string& filename) -> bool;
 
 private:
+    using DynamicGraph = BoykovKolmogorov<int, GridGraph<int>>;
+    // colors whose graphs incremental paints keep, later ones are cut
+    // from scratch every time
+    static constexpr int max_layers = 4;
+    // color graph kept between incremental paints
+    struct Layer {
+        std::array<u_char, 3> color;
+        std::unique_ptr<DynamicGraph> graph;
+        // 1 source, -1 sink, 0 none
+        std::vector<signed char> terminals;
+        std::vector<bool> used_pixels;
+    };
+
+    // scribble pixels grouped by color in one pass over the scribbles
+    struct ScribbleIndex {
+        // colors in the order they are first met, without the default
+        std::vector<std::array<u_char, 3>> palette;
+        // scribbles of palette[k] are pixels[offset[k] .. offset[k+1]),
+        // default colored ones come last
+        std::vector<int> offset;
+        std::vector<int> pixels;
+    };
+
     void init_gray(float gamma);
-    bool add_scribbles_edges(
-            Dinic<int>& graph,
-            std::unordered_set<unsigned int>& used_colors,
-            std::array<u_char, 3>& new_color,
-            Matrix<unsigned char>& scribbles);
+    auto node(int pixel) const -> int {
+        return node_of_pixel_.empty() ? pixel : node_of_pixel_[pixel];
+    }
+    void paint_incremental(Matrix<unsigned char>& scribbles);
+    void paint_multi_label(Matrix<unsigned char>& scribbles);
+    void paint_regions(Matrix<unsigned char>& scribbles);
+    // sequential cuts restricted to pixels, which are in raster order
+    void paint_region(
+            const std::vector<int>& pixels,
+            const std::vector<int>& seeds,
+            int colors);
+    // dispatch of segment on the selected mode and solver
+    void paint_labels(Matrix<unsigned char>& scribbles);
+    // paint_with without the clear and the composite
+    template <class graph_t>
+    void label_with(Matrix<unsigned char>& scribbles);
+    // scribbles with their palette reduced into merged, or scribbles
+    // itself when no limit is set
+    auto merge_colors(
+            Matrix<unsigned char>& scribbles,
+            Matrix<unsigned char>& merged) -> Matrix<unsigned char>&;
+    // every pixel unlabeled, an empty palette and nothing to repaint
+    void clear_labels();
+    // labels below palette.size() into the label plane, others unlabeled
+    void set_labels(
+            const std::vector<int>& labels,
+            const std::vector<std::array<u_char, 3>>& palette);
+    // painted from the label plane in one pass
+    void composite(Matrix<unsigned char>& painted);
+    // publishes a snapshot during async paints, false once cancelled
+    bool color_done(int done, int colors);
+    // the back snapshot becomes the front one
+    void publish();
+    // free pixels take the color of the closest scribble of color
+    // first_color or later, colors if none reaches them
+    void geodesic_fill(
+            const std::vector<int>& seeds,
+            int first_color,
+            int colors,
+            std::vector<int>& labels,
+            const std::vector<bool>& free);
+    void paint_pyramid(Matrix<unsigned char>& scribbles);
+    void paint_tiled(Matrix<unsigned char>& scribbles);
+    void paint_superpixels(Matrix<unsigned char>& scribbles);
+    // scribble_seeds with default scribbles unlabeled, palette_ takes the
+    // scribble order with colors only left in labels_ last, labels_ and
+    // seeds_ are renumbered to match
+    auto palette_seeds(Matrix<unsigned char>& scribbles) -> std::vector<int>;
+    // label_cuts around scribbles that differ from seeds_
+    void repaint(Matrix<unsigned char>& scribbles);
+    // rectangle [x0, x1) x [y0, y1)
+    struct Box {
+        int x0, y0, x1, y1;
+    };
+    // label_cuts on a crop of window of one pyramid level, pixels in free
+    // are solved, results in keep are written back to labels, returns
+    // whether any of them changed. seed_at gives the seed of a pixel of
+    // the level, weight and edge_scale are as for label_cuts
+    auto solve_window(
+            Box window, Box free, Box keep,
+            const Matrix<unsigned char>& gray,
+            const std::function<int(int)>& seed_at,
+            const std::vector<int>& weight,
+            int edge_scale,
+            int colors,
+            std::vector<std::uint16_t>& labels) -> bool;
+    // palette index of every scribble color in discovery order, the
+    // default color gets palette.size()
+    static auto scribble_palette(
+            const Matrix<unsigned char>& scribbles,
+            std::vector<std::array<u_char, 3>>& palette) -> std::unordered_map<unsigned int, int>;
+    // color index of every scribble in discovery order, the default
+    // color and its scribbles get palette.size()
+    auto scribble_seeds(
+            Matrix<unsigned char>& scribbles,
+            std::vector<std::array<u_char, 3>>& palette) -> std::vector<int>;
+    auto index_scribbles(Matrix<unsigned char>& scribbles) -> ScribbleIndex;
+    // per-color cuts on free pixels, other pixels keep their labels and
+    // border the free ones like sources (same color) or sinks (later).
+    // Coarse grids pass the scribble pixels each seed stands for as
+    // seed_weight and the fine edges a coarse edge crosses as edge_scale
+    void label_cuts(
+            const Matrix<unsigned char>& gray,
+            const std::vector<int>& seeds,
+            int colors,
+            std::vector<int>& labels,
+            const std::vector<bool>& free,
+            const std::vector<int>& seed_weight = {},
+            int edge_scale = 1);
+    // one level of a min-pooled pyramid, seeds as from scribble_seeds
+    // and the scribble pixels each of them stands for
+    struct Level {
+        Matrix<unsigned char> gray;
+        std::vector<int> seeds;
+        std::vector<int> weight;
+    };
+    // 2x2 blocks into one pixel: the darkest gray, and the seed of the
+    // color with the most weight in the block, which it adds up. An
+    // empty weight counts one per scribble pixel
+    static auto halve(
+            const Matrix<unsigned char>& gray,
+            const std::function<int(int)>& seed_at,
+            const std::vector<int>& weight,
+            int colors) -> Level;
+    // gray_ and seeds halved up to levels times, fewer once a side
+    // would drop below one pixel
+    auto pyramid(const std::vector<int>& seeds, int colors, int levels) const -> std::vector<Level>;
+    // full cut of the coarsest level, or of gray_ without levels
+    auto coarse_labels(
+            const std::vector<int>& seeds,
+            const std::vector<Level>& levels,
+            int colors) -> std::vector<int>;
+    // labels that can lower the energy by taking alpha do so,
+    // returns the number of changed pixels
+    auto expand(
+            int alpha,
+            std::vector<int>& labels,
+            std::vector<int>& seeds) -> int;
+    auto make_layer(
+            std::array<u_char, 3> color,
+            std::vector<signed char>& terminals,
+            std::vector<bool>& used_pixels) -> Layer;
+    void update_layer(
+            Layer& layer,
+            std::vector<signed char>& terminals,
+            std::vector<bool>& used_pixels);
+    bool has_drawing_edges(std::vector<bool>& used_pixels);
+    // solver storage kept between colors and paint calls, cleared
+    // instead of reallocated while the solver type and image stay
+    struct GraphArena {
+        virtual ~GraphArena() = default;
+    };
+    template <class graph_t>
+    struct GraphSlot;
+    template <class graph_t>
+    auto reusable_graph() -> graph_t&;
+    // fills a two-phase (CSR) graph in parallel row stripes
+    template <class graph_t>
+    void build_graph(
+            graph_t& graph,
+            std::vector<bool>& used_pixels,
+            std::vector<signed char>& terminals);
+    auto pool() -> ThreadPool&;
+    // scribbles of color become sources (1), the ones of the previous
+    // color sinks (-1) again, all others are expected to be sinks already
+    void mark_terminals(
+            const ScribbleIndex& index,
+            int color,
+            std::vector<signed char>& terminals);
+    template <class graph_t>
+    void add_scribbles_edges(
+            graph_t& graph,
+            const ScribbleIndex& index,
+            const std::vector<signed char>& terminals);
+    template <class graph_t>
     bool add_drawing_edges(
-            Dinic<int>& graph,
+            graph_t& graph,
             std::vector<bool>& used_pixels);
-    void blend_color(
-            std::vector<bool>& mask,
-            std::array<u_char, 3> color);
 
 private:
     Matrix<unsigned char> drawing_;
     Matrix<unsigned char> drawing_painted_;
     Matrix<unsigned char> gray_;
+    std::vector<std::uint16_t> labels_;
+    std::vector<std::array<u_char, 3>> palette_;
     const int terminal_capacity_ {23};
+    Solver solver_ {Solver::BOYKOV_KOLMOGOROV};
+    int threads_ {0};
+    bool incremental_ {false};
+    NodeOrder node_order_ {NodeOrder::RASTER};
+    bool multi_label_ {false};
+    int stroke_threshold_ {0};
+    int pyramid_levels_ {0};
+    int tile_size_ {0};
+    int superpixel_size_ {0};
+    int color_tolerance_ {0};
+    int min_color_pixels_ {0};
+    int max_colors_ {0};
+    int repaint_margin_ {0};
+    // palette_seeds of the labels_ painted last, empty if they can't be
+    // repainted
+    std::vector<int> seeds_;
+    // labels_ and palette_ of the last paint while a preview shows,
+    // empty otherwise
+    std::vector<std::uint16_t> repaint_labels_;
+    std::vector<std::array<u_char, 3>> repaint_palette_;
+    // empty for raster order
+    std::vector<int> node_of_pixel_;
+    std::unique_ptr<ThreadPool> pool_;
+    std::unique_ptr<GraphArena> arena_;
+    std::vector<Layer> layers_;
+
+    std::thread worker_;
+    std::atomic<bool> cancel_ {false};
+    std::atomic<bool> working_ {false};
+    // only set on the worker
+    bool async_ {false};
+    std::function<void(int, int)> progress_;
+    // front snapshot under the mutex, the worker composites into the back
+    std::mutex snapshot_mutex_;
+    Matrix<unsigned char> snapshot_;
+    int snapshot_version_ {0};
+    Matrix<unsigned char> snapshot_back_;
 };
 
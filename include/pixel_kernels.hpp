@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Whole image pixel loops: gray conversion with gamma, RGB to RGBA
+// expansion and compositing of a label plane. Every kernel has a scalar
+// version and x86 SSSE3/AVX2 versions chosen at runtime, all of them
+// write the same bytes.
+
+enum class SimdLevel {
+    SCALAR, SSSE3, AVX2
+};
+
+// best level of this cpu
+auto supported_simd_level() -> SimdLevel;
+auto simd_level() -> SimdLevel;
+// levels above supported_simd_level() fall back to it
+void set_simd_level(SimdLevel level);
+
+// floor(255 * pow(l / 255, exponent)) of the luma l = 0.2126 r +
+// 0.7152 g + 0.0722 b + 0.3 without pow: l in bucket [k/4, (k+1)/4)
+// starts at low[k] and steps up once per threshold it reaches.
+// Thresholds are the smallest lumas reaching a value, so lookups are
+// exact.
+struct GammaTable {
+    static constexpr int buckets_per_level = 4;
+
+    std::array<int, 256 * buckets_per_level + 2> low {};
+    // threshold[v] for v in 1..255, the ends are never passed
+    std::array<double, 257> threshold {};
+    int max_steps {};
+
+    // curve is x = l / 255 -> int value, non decreasing
+    template <class Curve>
+    constexpr explicit GammaTable(Curve curve);
+};
+
+// gamma 1/2 of Painter::init_gray, pow(x, 2) is the rounded x * x
+constexpr auto square_curve = [](double x) -> int {
+    return static_cast<int>(x * x * 255.0);
+};
+// the square table is compiled in, other gammas use std::pow at runtime
+auto gamma_table(float gamma) -> GammaTable;
+
+void rgb_to_gray(
+        const std::uint8_t* rgb,
+        std::uint8_t* gray,
+        int pixels,
+        const GammaTable& table);
+void rgb_to_rgba(const std::uint8_t* rgb, std::uint8_t* rgba, int pixels);
+// rgba = rgb * factor[label] per channel, truncated, labels above colors
+// use factor[colors], which holds (colors + 1) * 3 floats
+void composite_labels(
+        const std::uint8_t* rgb,
+        const std::uint16_t* labels,
+        int colors,
+        const float* factor,
+        std::uint8_t* rgba,
+        int pixels);
+
+
+// IMPLEMENTATION //
+template <class Curve>
+constexpr GammaTable::GammaTable(Curve curve) {
+    // the luma stays below 256
+    const double never = 512.0;
+    threshold[0] = -never;
+    threshold[256] = never;
+    for (int v = 1; v != 256; ++v) {
+        double lo = 0.0, hi = never;
+        if (curve(hi / 255.0) < v) {
+            threshold[v] = never;
+            continue;
+        }
+        // curve(lo) < v <= curve(hi) until they are neighbouring doubles
+        while (true) {
+            double mid = lo + (hi - lo) / 2;
+            if (mid == lo or mid == hi)
+                break;
+            (curve(mid / 255.0) < v ? lo : hi) = mid;
+        }
+        threshold[v] = hi;
+    }
+    const int buckets = low.size();
+    for (int k = 0; k != buckets; ++k) {
+        int v = curve(double(k) / buckets_per_level / 255.0);
+        low[k] = v < 0 ? 0 : v > 255 ? 255 : v;
+    }
+    for (int k = 0; k + 1 != buckets; ++k)
+        max_steps = low[k + 1] - low[k] > max_steps ? low[k + 1] - low[k] : max_steps;
+}
@@ -0,0 +1,466 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <cassert>
+#include <functional>
+
+#include "arc_graph.hpp"
+#include "thread_pool.hpp"
+
+// Synchronous parallel push-relabel max-flow.
+// Every round all active nodes push along admissible arcs in parallel,
+// then relabel in parallel. Labels are frozen while pushing, so two ends
+// of an arc are never admissible at the same time and residual
+// capacities need no locks; only incoming excess is accumulated
+// atomically. Global relabeling is a parallel BFS from the sink (and
+// from the source for nodes that can't reach it), gaps lift the nodes
+// above an empty label to the source side.
+//
+// The solver runs until the preflow becomes a flow, so partition() is
+// the same set as for Dinic: nodes reachable from source in the residual
+// graph.
+//
+// graph_t is the graph storage: ArcGraph or GridGraph.
+//
+// max_flow polls the stop callback set with set_stop before every round
+// and returns early once it says so. The preflow is then no flow and
+// the solver has to be cleared before the next max_flow.
+template <class flow_t, class graph_t = ArcGraph<flow_t>>
+class PushRelabel {
+public:
+    using graph_type = graph_t;
+
+    PushRelabel() = delete;
+    PushRelabel(int V);
+    PushRelabel(int height, int width);
+    ~PushRelabel() = default;
+
+    void add_directional_edge(int u, int v, flow_t capacity);
+    void add_bidirectional_edge(int u, int v, flow_t capacity);
+    // empty graph for a new problem without a stop callback, node
+    // arrays keep their memory
+    void clear();
+
+    auto V() const -> int { return graph_.V(); }
+    auto graph() -> graph_t& { return graph_; }
+
+    // 0 = one thread per core
+    void set_threads(int threads) { threads_ = threads; }
+
+    auto max_flow(int source, int sink) -> flow_t;
+    void set_stop(std::function<bool()> stop) { stop_ = std::move(stop); }
+    // the last max_flow call returned early
+    auto stopped() const -> bool { return stopped_; }
+    // returns edges in minimum cut in form <node_from, node_to>
+    auto min_cut(int source) -> std::vector<std::pair<int, int>>;
+    // reachable=1 unreachable=0
+    auto partition(int source) -> std::vector<bool>;
+
+private:
+    void init();
+    void global_relabel();
+    // labels nodes that have a residual path into frontier,
+    // visited nodes stay touched until global_relabel clears them
+    void reverse_bfs(std::vector<int>& frontier);
+    void push_phase();
+    auto relabel_phase() -> int;
+    void remove_gap(int gap);
+    void collect(std::vector<std::vector<int>>& local, std::vector<int>& out);
+
+private:
+    graph_t graph_;
+    int source_ {-1};
+    int sink_ {-1};
+    bool flow_called_ {false};
+    std::function<bool()> stop_;
+    bool stopped_ {false};
+    int threads_ {0};
+    std::unique_ptr<ThreadPool> pool_;
+
+    int n_ {};
+    int dead_ {};
+    flow_t flow_ {};
+
+    // >0 capacity source->node, <0 capacity node->sink after folding
+    std::vector<flow_t> tr_cap_;
+    std::vector<flow_t> source_flow_;
+    std::vector<flow_t> sink_res_;
+    std::vector<flow_t> excess_;
+    std::vector<int> label_;
+    std::vector<int> new_label_;
+    std::unique_ptr<std::atomic<flow_t>[]> added_;
+    std::unique_ptr<std::atomic<unsigned char>[]> touched_;
+    std::unique_ptr<std::atomic<int>[]> count_;
+    // nodes the atomic arrays were made for
+    int allocated_ {};
+    std::vector<std::atomic<flow_t>> sink_flow_;
+
+    std::vector<int> active_;
+    std::vector<std::vector<int>> local_;
+    long long relabels_since_global_ {};
+};
+
+template <class flow_t, class graph_t>
+PushRelabel<flow_t, graph_t>::PushRelabel(int V)
+    : graph_(V)
+{ }
+
+template <class flow_t, class graph_t>
+PushRelabel<flow_t, graph_t>::PushRelabel(int height, int width)
+    : graph_(height, width)
+{ }
+
+template <class flow_t, class graph_t>
+void PushRelabel<flow_t, graph_t>::clear() {
+    graph_.clear();
+    flow_called_ = false;
+    stop_ = nullptr;
+    stopped_ = false;
+}
+
+template <class flow_t, class graph_t>
+void PushRelabel<flow_t, graph_t>::add_directional_edge(int u, int v, flow_t capacity) {
+    graph_.add_directional_edge(u, v, capacity);
+}
+
+template <class flow_t, class graph_t>
+void PushRelabel<flow_t, graph_t>::add_bidirectional_edge(int u, int v, flow_t capacity) {
+    graph_.add_bidirectional_edge(u, v, capacity);
+}
+
+template <class flow_t, class graph_t>
+auto PushRelabel<flow_t, graph_t>::max_flow(int source, int sink) -> flow_t {
+    assert(0 <= std::min(source, sink) && std::max(source, sink) < V());
+    assert(source != sink);
+    // terminal arcs are consumed by the first call
+    assert(!flow_called_);
+
+    source_ = source;
+    sink_ = sink;
+    flow_ = graph_.fold_terminals(source, sink, tr_cap_);
+    init();
+
+    global_relabel();
+    active_.clear();
+    for (int node = 0; node != n_; ++node)
+        if (excess_[node] > 0 and label_[node] < dead_)
+            active_.push_back(node);
+
+    stopped_ = false;
+    while (!active_.empty()) {
+        if (stop_ and stop_()) {
+            stopped_ = true;
+            break;
+        }
+        push_phase();
+        relabels_since_global_ += relabel_phase();
+
+        if (relabels_since_global_ > n_) {
+            global_relabel();
+            active_.erase(
+                    std::remove_if(active_.begin(), active_.end(),
+                        [this](int node) { return label_[node] >= dead_; }),
+                    active_.end());
+        }
+    }
+
+    for (int t = 0; t != pool_->size(); ++t)
+        flow_ += sink_flow_[t].load();
+
+    flow_called_ = true;
+    return flow_;
+}
+
+template <class flow_t, class graph_t>
+auto PushRelabel<flow_t, graph_t>::min_cut(int source) -> std::vector<std::pair<int, int>> {
+    assert(flow_called_);
+
+    return graph_.min_cut(partition(source));
+}
+
+template <class flow_t, class graph_t>
+auto PushRelabel<flow_t, graph_t>::partition(int source) -> std::vector<bool> {
+    assert(flow_called_);
+    assert(source == source_);
+
+    std::vector<bool> partition(n_, false);
+    std::vector<int> st;
+    for (int node = 0; node != n_; ++node) {
+        if (source_flow_[node] < std::max(tr_cap_[node], flow_t{0})) {
+            partition[node] = true;
+            st.push_back(node);
+        }
+    }
+    while (!st.empty()) {
+        int cur = st.back();
+        st.pop_back();
+        for (int a = graph_.first_arc(cur); a != graph_t::noarc; a = graph_.next_arc(a)) {
+            int next = graph_.head(a);
+            if (graph_.capacity(a) > 0 and !partition[next]) {
+                partition[next] = true;
+                st.push_back(next);
+            }
+        }
+    }
+    partition[source_] = true;
+    partition[sink_] = false;
+
+    return partition;
+}
+
+template <class flow_t, class graph_t>
+void PushRelabel<flow_t, graph_t>::init() {
+    n_ = V();
+    // source has label n_, nodes that can reach neither terminal are dead
+    dead_ = 2 * n_ + 1;
+
+    if (!pool_ or (threads_ > 0 and pool_->size() != threads_))
+        pool_ = std::make_unique<ThreadPool>(threads_);
+
+    source_flow_.assign(n_, 0);
+    sink_res_.assign(n_, 0);
+    excess_.assign(n_, 0);
+    label_.assign(n_, dead_);
+    new_label_.assign(n_, dead_);
+    // atomics can't be resized, they are only replaced for a new size
+    if (!added_ or allocated_ != n_) {
+        added_ = std::make_unique<std::atomic<flow_t>[]>(n_);
+        touched_ = std::make_unique<std::atomic<unsigned char>[]>(n_);
+        count_ = std::make_unique<std::atomic<int>[]>(n_ + 1);
+        allocated_ = n_;
+    }
+    if (static_cast<int>(sink_flow_.size()) != pool_->size())
+        sink_flow_ = std::vector<std::atomic<flow_t>>(pool_->size());
+    local_.resize(pool_->size());
+    for (auto& part : local_)
+        part.clear();
+
+    // saturate all source arcs
+    for (int node = 0; node != n_; ++node) {
+        added_[node] = 0;
+        touched_[node] = 0;
+        if (tr_cap_[node] > 0) {
+            source_flow_[node] = tr_cap_[node];
+            excess_[node] = tr_cap_[node];
+        }
+        else {
+            sink_res_[node] = -tr_cap_[node];
+        }
+    }
+    for (int t = 0; t != pool_->size(); ++t)
+        sink_flow_[t] = 0;
+}
+
+template <class flow_t, class graph_t>
+void PushRelabel<flow_t, graph_t>::global_relabel() {
+    relabels_since_global_ = 0;
+    std::fill(label_.begin(), label_.end(), dead_);
+
+    // exact distances to sink
+    std::vector<int> frontier;
+    for (int node = 0; node != n_; ++node) {
+        if (sink_res_[node] > 0) {
+            label_[node] = 1;
+            frontier.push_back(node);
+        }
+    }
+    reverse_bfs(frontier);
+
+    // the rest returns its excess to source
+    for (int node = 0; node != n_; ++node) {
+        if (label_[node] == dead_ and source_flow_[node] > 0) {
+            label_[node] = n_ + 1;
+            frontier.push_back(node);
+        }
+    }
+    reverse_bfs(frontier);
+
+    pool_->parallel_for(n_, [&](int begin, int end, int) {
+        for (int node = begin; node != end; ++node)
+            touched_[node].store(0, std::memory_order_relaxed);
+    });
+
+    for (int l = 0; l <= n_; ++l)
+        count_[l] = 0;
+    // sink
+    count_[0] = 1;
+    pool_->parallel_for(n_, [&](int begin, int end, int) {
+        for (int node = begin; node != end; ++node)
+            if (label_[node] < n_)
+                count_[label_[node]].fetch_add(1, std::memory_order_relaxed);
+    });
+}
+
+template <class flow_t, class graph_t>
+void PushRelabel<flow_t, graph_t>::reverse_bfs(std::vector<int>& frontier) {
+    for (int node : frontier)
+        touched_[node].store(1, std::memory_order_relaxed);
+
+    std::vector<int> next;
+    while (!frontier.empty()) {
+        pool_->parallel_for(frontier.size(), [&](int begin, int end, int t) {
+            auto& out = local_[t];
+            for (int i = begin; i != end; ++i) {
+                int cur = frontier[i];
+                for (int a = graph_.first_arc(cur); a != graph_t::noarc; a = graph_.next_arc(a)) {
+                    int prev = graph_.head(a);
+                    if (graph_.capacity(graph_.sister(a)) == 0)
+                        continue;
+                    if (touched_[prev].load(std::memory_order_relaxed))
+                        continue;
+                    if (touched_[prev].exchange(1, std::memory_order_relaxed))
+                        continue;
+                    label_[prev] = label_[cur] + 1;
+                    out.push_back(prev);
+                }
+            }
+        });
+        collect(local_, next);
+        frontier.swap(next);
+    }
+}
+
+template <class flow_t, class graph_t>
+void PushRelabel<flow_t, graph_t>::push_phase() {
+    pool_->parallel_for(active_.size(), [&](int begin, int end, int t) {
+        auto& out = local_[t];
+        flow_t to_sink = 0;
+        for (int i = begin; i != end; ++i) {
+            int node = active_[i];
+            flow_t excess = excess_[node];
+            const int label = label_[node];
+
+            if (label == 1 and sink_res_[node] > 0) {
+                flow_t delta = std::min(excess, sink_res_[node]);
+                sink_res_[node] -= delta;
+                excess -= delta;
+                to_sink += delta;
+            }
+
+            for (int a = graph_.first_arc(node); excess > 0 and a != graph_t::noarc; a = graph_.next_arc(a)) {
+                // check the label first: the other end may be pushing
+                // into this node and updating this arc right now
+                int next = graph_.head(a);
+                if (label != label_[next] + 1)
+                    continue;
+                flow_t cap = graph_.capacity(a);
+                if (cap == 0)
+                    continue;
+
+                flow_t delta = std::min(excess, cap);
+                graph_.capacity(a) -= delta;
+                graph_.capacity(graph_.sister(a)) += delta;
+                excess -= delta;
+                added_[next].fetch_add(delta, std::memory_order_relaxed);
+                if (!touched_[next].exchange(1, std::memory_order_relaxed))
+                    out.push_back(next);
+            }
+
+            if (excess > 0 and label == n_ + 1 and source_flow_[node] > 0) {
+                flow_t delta = std::min(excess, source_flow_[node]);
+                source_flow_[node] -= delta;
+                excess -= delta;
+            }
+
+            excess_[node] = excess;
+            if (excess > 0 and !touched_[node].exchange(1, std::memory_order_relaxed))
+                out.push_back(node);
+        }
+        sink_flow_[t].fetch_add(to_sink, std::memory_order_relaxed);
+    });
+
+    collect(local_, active_);
+
+    pool_->parallel_for(active_.size(), [&](int begin, int end, int) {
+        for (int i = begin; i != end; ++i) {
+            int node = active_[i];
+            touched_[node].store(0, std::memory_order_relaxed);
+            excess_[node] += added_[node].exchange(0, std::memory_order_relaxed);
+        }
+    });
+}
+
+// returns number of relabeled nodes
+template <class flow_t, class graph_t>
+auto PushRelabel<flow_t, graph_t>::relabel_phase() -> int {
+    std::atomic<int> relabeled {0};
+    std::atomic<int> gap {n_};
+
+    pool_->parallel_for(active_.size(), [&](int begin, int end, int) {
+        int local_relabeled = 0;
+        int local_gap = n_;
+        for (int i = begin; i != end; ++i) {
+            int node = active_[i];
+            const int label = label_[node];
+            new_label_[node] = label;
+
+            // sink and source are at labels 0 and n_
+            int lowest = dead_;
+            if (sink_res_[node] > 0)
+                lowest = 0;
+            if (source_flow_[node] > 0)
+                lowest = std::min(lowest, n_);
+            for (int a = graph_.first_arc(node); lowest >= label and a != graph_t::noarc; a = graph_.next_arc(a))
+                if (graph_.capacity(a) > 0)
+                    lowest = std::min(lowest, label_[graph_.head(a)]);
+
+            if (lowest < label)
+                continue;
+
+            int new_label = std::min(lowest + 1, dead_);
+            new_label_[node] = new_label;
+            ++local_relabeled;
+            if (label < n_ and count_[label].fetch_sub(1, std::memory_order_relaxed) == 1)
+                local_gap = std::min(local_gap, label);
+            if (new_label < n_)
+                count_[new_label].fetch_add(1, std::memory_order_relaxed);
+        }
+        relabeled.fetch_add(local_relabeled, std::memory_order_relaxed);
+        int cur = gap.load(std::memory_order_relaxed);
+        while (local_gap < cur and !gap.compare_exchange_weak(cur, local_gap)) {}
+    });
+
+    pool_->parallel_for(active_.size(), [&](int begin, int end, int) {
+        for (int i = begin; i != end; ++i)
+            label_[active_[i]] = new_label_[active_[i]];
+    });
+
+    // the label may have been taken again by another node
+    int g = gap.load();
+    if (g < n_ and count_[g].load() == 0)
+        remove_gap(g);
+
+    active_.erase(
+            std::remove_if(active_.begin(), active_.end(),
+                [this](int node) { return label_[node] >= dead_; }),
+            active_.end());
+
+    return relabeled.load();
+}
+
+// nodes above an empty label can't reach sink anymore
+template <class flow_t, class graph_t>
+void PushRelabel<flow_t, graph_t>::remove_gap(int gap) {
+    pool_->parallel_for(n_, [&](int begin, int end, int) {
+        for (int node = begin; node != end; ++node) {
+            int label = label_[node];
+            if (gap < label and label < n_) {
+                count_[label].fetch_sub(1, std::memory_order_relaxed);
+                label_[node] = n_;
+            }
+        }
+    });
+}
+
+template <class flow_t, class graph_t>
+void PushRelabel<flow_t, graph_t>::collect(std::vector<std::vector<int>>& local, std::vector<int>& out) {
+    out.clear();
+    for (auto& part : local) {
+        out.insert(out.end(), part.begin(), part.end());
+        part.clear();
+    }
+}
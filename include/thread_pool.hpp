@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+// Fixed set of worker threads for data-parallel loops.
+// The calling thread works as thread 0.
+class ThreadPool {
+public:
+    // 0 = one thread per core
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+    auto size() const -> int { return threads_; }
+
+    // calls fn(begin, end, thread_id) on [0, n) split into at most size()
+    // contiguous chunks and waits for all of them
+    template <class F>
+    void parallel_for(int n, F&& fn);
+
+private:
+    void run(const std::function<void(int)>& job);
+    void worker(int id);
+
+private:
+    int threads_ {1};
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    const std::function<void(int)>* job_ {nullptr};
+    unsigned generation_ {0};
+    int pending_ {0};
+    bool stop_ {false};
+};
+
+template <class F>
+void ThreadPool::parallel_for(int n, F&& fn) {
+    if (n <= 0)
+        return;
+
+    const int chunks = std::min(threads_, n);
+    if (chunks == 1) {
+        fn(0, n, 0);
+        return;
+    }
+
+    std::function<void(int)> job = [&](int id) {
+        if (id >= chunks)
+            return;
+        int begin = static_cast<long long>(n) * id / chunks;
+        int end = static_cast<long long>(n) * (id + 1) / chunks;
+        fn(begin, end, id);
+    };
+    run(job);
+}
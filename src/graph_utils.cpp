@@ -7,10 +7,10 @@ void add_img_edges(
 ) {
     assert(!img.empty());
     assert(img.channels() == 1);
-    assert(img.size() + 2 == graph.V());
+    assert(static_cast<int>(img.size()) + 2 == graph.V());
 
-    const auto size = img.size();
-    const auto width = img.width();
+    const int size = img.size();
+    const int width = img.width();
 
     unsigned char zero_cancel = 1;
     auto* pt = img.pt();
@@ -41,12 +41,12 @@ void add_scribble_edges(
 ) { 
     assert(!scribbles.empty());
     assert(scribbles.channels() == 4);
-    assert(scribbles.size()/scribbles.channels() + 2 == graph.V());
+    assert(static_cast<int>(scribbles.size()/scribbles.channels()) + 2 == graph.V());
     
     int source = graph.V()-2;
     int sink = source + 1;
 
-    const auto size = scribbles.size();
+    const int size = scribbles.size();
     auto* pt = scribbles.pt();
 
     for (int i = 0; i < size; i += 4) {
@@ -74,12 +74,12 @@ void add_scribble_edges(
 ) { 
     assert(!scribbles.empty());
     assert(scribbles.channels() == 4);
-    assert(scribbles.size()/scribbles.channels() + 2 == graph.V());
+    assert(static_cast<int>(scribbles.size()/scribbles.channels()) + 2 == graph.V());
     
     int source = graph.V()-2;
     int sink = source + 1;
 
-    const auto size = scribbles.size();
+    const int size = scribbles.size();
     auto* pt = scribbles.pt();
 
     for (int i = 0; i < size; i += 4) {
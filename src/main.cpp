@@ -1,5 +1,11 @@
 #include <iostream>
+#include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "matrix.hpp"
 #include "matrix_utils.hpp"
@@ -32,9 +38,45 @@ private:
     }
 };
 
+void print_usage(const char* name) {
+    std::cout 
+        << "usage: " << name << " <drawing> <scribbles> [options]\n"
+        << "  --solver=dinic|ek|bk|pr  max-flow solver (default bk)\n"
+        << "  --threads=N              threads for parallel solvers (default: all cores)\n"
+        << "  --order=raster|tiled|morton  node numbering for dinic, ek (default raster)\n"
+        << "  --multi-label            segment all colors together (alpha-expansion), one\n"
+        << "                           whole-image cut per color, slower and not identical\n"
+        << "                           to the default where colors compete for a region\n"
+        << "  --regions=N              split regions at pixels darker than N and solve them in parallel\n"
+        << "  --pyramid=N              solve N halved levels first, then refine around boundaries\n"
+        << "  --tiles=N                refine a coarse pass in NxN tiles solved in parallel\n"
+        << "  --superpixels=N          cut a graph of superpixels grown from an NxN grid\n"
+        << "  --preview                approximate geodesic fill instead of a cut\n"
+        << "  --budget=MS              paint within MS milliseconds, late colors are approximate\n"
+        << "  --tolerance=N            merge scribble colors closer than N per channel\n"
+        << "  --min-pixels=N           drop merged colors with fewer scribble pixels\n"
+        << "  --max-colors=N           paint at most N colors, rare ones join the closest\n"
+        << "  --frames=A,B,...         later frames of a sequence, each painted from the labels\n"
+        << "                           of the one before into result_N.png\n";
+}
+
+// the whole text as a non-negative int
+auto parse_count(std::string_view text) -> std::optional<int> {
+    int value = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() or end != text.data() + text.size() or value < 0)
+        return std::nullopt;
+    return value;
+}
+
 int main(int argc, char* argv[]) {
     TimerGuard tg{"total time:"};
 
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
     std::string drawing_image_path = argv[1];
     std::string scribbles_image_path = argv[2];
 
@@ -44,16 +86,110 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    bool preview = false;
+    int budget = 0;
+    std::vector<std::string> frames;
+    for (int i = 3; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        // value of a numeric flag, nullopt for other flags and bad numbers
+        auto number = [arg](std::string_view flag) -> std::optional<int> {
+            if (arg.rfind(flag, 0) != 0)
+                return std::nullopt;
+            return parse_count(arg.substr(flag.size()));
+        };
+        if (arg.rfind("--solver=", 0) == 0) {
+            auto solver = parse_solver(arg.substr(9));
+            if (!solver) {
+                std::cout << "Unknown solver: " << arg.substr(9) << std::endl;
+                return 1;
+            }
+            painter.set_solver(*solver);
+        }
+        else if (arg.rfind("--order=", 0) == 0) {
+            auto order = parse_node_order(arg.substr(8));
+            if (!order) {
+                std::cout << "Unknown node order: " << arg.substr(8) << std::endl;
+                return 1;
+            }
+            painter.set_node_order(*order);
+        }
+        else if (auto n = number("--regions=")) {
+            painter.set_stroke_threshold(*n);
+        }
+        else if (auto n = number("--pyramid=")) {
+            painter.set_pyramid_levels(*n);
+        }
+        else if (auto n = number("--tiles=")) {
+            painter.set_tile_size(*n);
+        }
+        else if (auto n = number("--superpixels=")) {
+            painter.set_superpixel_size(*n);
+        }
+        else if (auto n = number("--budget=")) {
+            budget = *n;
+        }
+        else if (auto n = number("--tolerance=")) {
+            painter.set_color_tolerance(*n);
+        }
+        else if (auto n = number("--min-pixels=")) {
+            painter.set_min_color_pixels(*n);
+        }
+        else if (auto n = number("--max-colors=")) {
+            painter.set_max_colors(*n);
+        }
+        else if (arg.rfind("--frames=", 0) == 0) {
+            auto list = arg.substr(9);
+            while (!list.empty()) {
+                auto comma = std::min(list.find(','), list.size());
+                frames.emplace_back(list.substr(0, comma));
+                list.remove_prefix(std::min(comma + 1, list.size()));
+            }
+        }
+        else if (arg == "--preview") {
+            preview = true;
+        }
+        else if (arg == "--multi-label") {
+            painter.set_multi_label(true);
+        }
+        else if (auto n = number("--threads=")) {
+            painter.set_threads(*n);
+        }
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
     auto scribbles = imread(scribbles_image_path.data());
     if (scribbles.empty()) {
         std::cout << "Failed to load the scribble image." << std::endl;
         return 1;
     }
 
-    painter.paint(scribbles);
+    if (preview) {
+        painter.preview(scribbles);
+    }
+    else if (budget > 0) {
+        auto exact = painter.paint_within(scribbles, std::chrono::milliseconds(budget));
+        std::cout << "exact pixels: " << std::count(exact.begin(), exact.end(), true)
+            << '/' << exact.size() << '\n';
+    }
+    else {
+        painter.paint(scribbles);
+    }
 
     painter.imwrite("result.png");
 
+    for (size_t frame = 0; frame != frames.size(); ++frame) {
+        TimerGuard frame_timer{"frame " + std::to_string(frame + 1) + " time:"};
+        if (!painter.paint_next_frame(frames[frame].data(), scribbles)) {
+            std::cout << "Failed to load frame " << frames[frame]
+                << " or it is not the size of the scribbles" << std::endl;
+            return 1;
+        }
+        painter.imwrite("result_" + std::to_string(frame + 1) + ".png");
+    }
+
     return 0;
 }
 
@@ -1,4 +1,5 @@
 #include "matrix_utils.hpp"
+#include "pixel_kernels.hpp"
 
 #include <cmath>
 #include <array>
@@ -87,7 +88,7 @@ auto to_gray(const Matrix<unsigned char>& m) -> Matrix<unsigned char> {
     // 3 channels version
     auto p_orig = m.pt();
     auto p_gray = gray.pt();
-    auto size = m.size();
+    const int size = m.size();
     for (int i = 0, j = 0; i < size; ++j, i += 3) {
         auto gray_value = p_orig[i]*0.2126 + p_orig[i+1]*0.7152 + p_orig[i+2]*0.0722 + 0.3;  
         p_gray[j] = (gray_value < 0.0f) ? 0 : ((gray_value > 255.0f) ? 255 : (unsigned char)gray_value);
@@ -107,16 +108,7 @@ auto to_gray_gamma(const Matrix<unsigned char>& m, float gamma) -> Matrix<unsign
 
     Matrix<unsigned char> gray(m.height(), m.width(), 1);
 
-    // 3 channels version
-    auto p_orig = m.pt();
-    auto p_gray = gray.pt();
-    auto size = m.size();
-    for (int i = 0, j = 0; i < size; ++j, i += 3) {
-        auto gray_value = (p_orig[i]*0.2126 + p_orig[i+1]*0.7152 + p_orig[i+2]*0.0722 + 0.3) / 255.0;
-        auto gray_value_corrected = std::pow(gray_value, 1/gamma);
-        auto gray_value_scaled = static_cast<unsigned char>(gray_value_corrected * 255.0);
-        p_gray[j] = gray_value_scaled;
-    }
+    rgb_to_gray(m.pt(), gray.pt(), gray.size(), gamma_table(gamma));
 
     return gray;
 }
@@ -138,7 +130,7 @@ void blend_color(
         std::vector<bool>& mask
 ) {
     auto* p = img.pt();
-    auto size = img.size();
+    const int size = img.size();
     for (int i = 0; i < size; i += 3) {
         if (!mask[i/3])
             continue;
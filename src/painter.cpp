@@ -1,12 +1,99 @@
 #include "painter.hpp"
 
 #include "dinic.hpp"
+#include "edmonds_karp.hpp"
+#include "boykov_kolmogorov.hpp"
+#include "grid_graph.hpp"
+#include "pixel_kernels.hpp"
+#include "push_relabel.hpp"
 
 #include "stb_image.h"
 #include "stb_image_write.h"
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <type_traits>
 #include <sys/types.h>
 
+auto parse_solver(std::string_view name) -> std::optional<Solver> {
+    if (name == "dinic")
+        return Solver::DINIC;
+    if (name == "ek")
+        return Solver::EDMONDS_KARP;
+    if (name == "bk")
+        return Solver::BOYKOV_KOLMOGOROV;
+    if (name == "pr")
+        return Solver::PUSH_RELABEL;
+    return std::nullopt;
+}
+
+auto solver_name(Solver solver) -> std::string_view {
+    switch (solver) {
+    case Solver::DINIC:
+        return "dinic";
+    case Solver::EDMONDS_KARP:
+        return "ek";
+    case Solver::BOYKOV_KOLMOGOROV:
+        return "bk";
+    case Solver::PUSH_RELABEL:
+        return "pr";
+    }
+    return "";
+}
+
+auto parse_node_order(std::string_view name) -> std::optional<NodeOrder> {
+    if (name == "raster")
+        return NodeOrder::RASTER;
+    if (name == "tiled")
+        return NodeOrder::TILED;
+    if (name == "morton")
+        return NodeOrder::MORTON;
+    return std::nullopt;
+}
+
+// spreads the low 32 bits of x to the even bits
+static auto spread_bits(uint64_t x) -> uint64_t {
+    x &= 0xffffffff;
+    x = (x | (x << 16)) & 0x0000ffff0000ffff;
+    x = (x | (x << 8)) & 0x00ff00ff00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0f;
+    x = (x | (x << 2)) & 0x3333333333333333;
+    x = (x | (x << 1)) & 0x5555555555555555;
+    return x;
+}
+
+auto node_numbering(int height, int width, NodeOrder order) -> std::vector<int> {
+    const int pixels = height * width;
+    std::vector<int> nodes(pixels);
+
+    if (order == NodeOrder::RASTER) {
+        for (int i = 0; i != pixels; ++i)
+            nodes[i] = i;
+    }
+    else if (order == NodeOrder::TILED) {
+        // tiles in raster order, pixels of a tile in raster order
+        const int tile = 32;
+        int id = 0;
+        for (int ty = 0; ty < height; ty += tile)
+            for (int tx = 0; tx < width; tx += tile)
+                for (int y = ty; y != std::min(ty + tile, height); ++y)
+                    for (int x = tx; x != std::min(tx + tile, width); ++x)
+                        nodes[y * width + x] = id++;
+    }
+    else {
+        // z-order curve, ranks keep ids dense for any image shape
+        std::vector<std::pair<uint64_t, int>> codes(pixels);
+        for (int i = 0; i != pixels; ++i)
+            codes[i] = {spread_bits(i % width) | spread_bits(i / width) << 1, i};
+        std::sort(codes.begin(), codes.end());
+        for (int id = 0; id != pixels; ++id)
+            nodes[codes[id].second] = id;
+    }
+    return nodes;
+}
+
 Painter::Painter(const char* filename, int terminal_capacity)
     : terminal_capacity_{terminal_capacity}
 { 
@@ -35,83 +122,1876 @@ unsigned int color_to_int(const std::array<u_char, 3>& color) {
     return (red << 16) | (green << 8) | blue;
 }
 
-void Painter::blend_color(
-        std::vector<bool>& mask,
-        std::array<u_char, 3> color
-) {
-    assert(drawing_painted_.channels() == 4);
+void Painter::set_incremental(bool incremental) {
+    incremental_ = incremental;
+    if (!incremental_)
+        layers_.clear();
+}
+
+void Painter::clear_labels() {
+    labels_.assign(gray_.size(), unlabeled);
+    palette_.clear();
+    seeds_.clear();
+    repaint_labels_.clear();
+    repaint_palette_.clear();
+}
+
+void Painter::set_repaint_margin(int margin) {
+    repaint_margin_ = margin;
+    seeds_.clear();
+    repaint_labels_.clear();
+    repaint_palette_.clear();
+}
+
+void Painter::set_labels(
+        const std::vector<int>& labels,
+        const std::vector<std::array<u_char, 3>>& palette)
+{
+    assert(labels.size() == labels_.size());
+
+    const int colors = palette.size();
+    palette_ = palette;
+    for (size_t i = 0; i != labels.size(); ++i)
+        labels_[i] = 0 <= labels[i] and labels[i] < colors ? labels[i] : unlabeled;
+}
+
+void Painter::composite(Matrix<unsigned char>& painted) {
     assert(drawing_.channels() == 3);
+    assert(palette_.size() < unlabeled);
+
+    if (painted.size() != 4 * labels_.size())
+        painted.reset(gray_.height(), gray_.width(), 4);
+
+    // channel factors of every label, unlabeled pixels get the last
+    // one and keep the drawing
+    const int colors = palette_.size();
+    std::vector<float> factor(3 * (colors + 1), 1.f);
+    for (int k = 0; k != colors; ++k)
+        for (int c = 0; c != 3; ++c)
+            factor[3*k + c] = palette_[k][c] / 255.f;
 
-    std::array<float, 3> color_ = {
-        color[0]/255.f,
-        color[1]/255.f,
-        color[2]/255.f
+    composite_labels(drawing_.pt(), labels_.data(), colors, factor.data(), painted.pt(), labels_.size());
+}
+
+// Colors are clustered greedily from the most used one, a color joins
+// the first representative within color_tolerance_. Representatives are
+// then cut down to max_colors_ by use, and dropped below
+// min_color_pixels_. Scribbles take their representative's color, so the
+// order in which colors are first met stays the same.
+auto Painter::merge_colors(
+        Matrix<unsigned char>& scribbles,
+        Matrix<unsigned char>& merged) -> Matrix<unsigned char>&
+{
+    if (color_tolerance_ <= 0 and min_color_pixels_ <= 0 and max_colors_ <= 0)
+        return scribbles;
+    assert(scribbles.channels() == 4);
+
+    const int size = scribbles.size() / 4;
+    auto* pt = scribbles.pt();
+    // default scribbles are kept as they are, they are not a paint color
+    const auto default_color = color_to_int({255, 255, 255});
+    std::unordered_map<unsigned int, int> count;
+    for (int i = 0; i != size; ++i) {
+        if (pt[4*i+3] == 0)
+            continue;
+        auto color = color_to_int({pt[4*i], pt[4*i+1], pt[4*i+2]});
+        if (color != default_color)
+            ++count[color];
+    }
+
+    std::vector<std::pair<int, unsigned int>> by_use;
+    for (auto [color, pixels] : count)
+        by_use.emplace_back(pixels, color);
+    // ties by color, so the result doesn't depend on hashing
+    std::sort(by_use.begin(), by_use.end(), std::greater<>());
+
+    auto distance = [](unsigned int a, unsigned int b) {
+        int d = 0;
+        for (int shift = 0; shift != 24; shift += 8)
+            d = std::max(d, std::abs(int(a >> shift & 255) - int(b >> shift & 255)));
+        return d;
     };
-    auto* p_pt = drawing_painted_.pt();
-    auto* o_pt = drawing_.pt();
-    auto size = drawing_.size();
-    int p_id = 0;
-    for (int i = 0, j = 0; i < size; i += 3, j += 4) {
-        if (!mask[i/3])
+    auto closest = [&](unsigned int color, const std::vector<unsigned int>& among) {
+        return *std::min_element(among.begin(), among.end(), [&](auto a, auto b) {
+            return distance(color, a) < distance(color, b);
+        });
+    };
+
+    std::vector<unsigned int> representatives;
+    std::unordered_map<unsigned int, int> use;
+    std::unordered_map<unsigned int, unsigned int> to;
+    for (auto [pixels, color] : by_use) {
+        auto rep = color;
+        if (!representatives.empty() and distance(color, closest(color, representatives)) <= color_tolerance_)
+            rep = closest(color, representatives);
+        else
+            representatives.push_back(color);
+        to[color] = rep;
+        use[rep] += pixels;
+    }
+
+    // kept representatives by use, the rest joins the closest kept one
+    std::stable_sort(representatives.begin(), representatives.end(), [&](auto a, auto b) {
+        return use[a] > use[b];
+    });
+    if (max_colors_ > 0 and static_cast<int>(representatives.size()) > max_colors_) {
+        std::vector<unsigned int> kept(representatives.begin(), representatives.begin() + max_colors_);
+        for (auto rep : std::vector<unsigned int>(representatives.begin() + max_colors_, representatives.end())) {
+            auto target = closest(rep, kept);
+            use[target] += use[rep];
+            for (auto& [color, r] : to)
+                if (r == rep)
+                    r = target;
+        }
+        representatives.swap(kept);
+    }
+
+    merged = scribbles.copy();
+    auto* m_pt = merged.pt();
+    for (int i = 0; i != size; ++i) {
+        if (m_pt[4*i+3] == 0)
+            continue;
+        auto color = color_to_int({m_pt[4*i], m_pt[4*i+1], m_pt[4*i+2]});
+        if (color == default_color)
             continue;
-        p_pt[j] = o_pt[i] * color_[0];
-        p_pt[j+1] = o_pt[i+1] * color_[1];
-        p_pt[j+2] = o_pt[i+2] * color_[2];
-        p_pt[j+3] = 255;
+        auto rep = to[color];
+        if (use[rep] < min_color_pixels_) {
+            m_pt[4*i+3] = 0;
+            continue;
+        }
+        m_pt[4*i] = rep >> 16;
+        m_pt[4*i+1] = rep >> 8;
+        m_pt[4*i+2] = rep;
     }
+    return merged;
 }
 
 void Painter::paint(Matrix<unsigned char>& scribbles) {
-    const std::array<u_char, 3> default_color {255, 255, 255};
+    segment(scribbles);
+    composite(drawing_painted_);
+}
+
+void Painter::segment(Matrix<unsigned char>& input) {
+    Matrix<unsigned char> merged;
+    auto& scribbles = merge_colors(input, merged);
+    // repaints re-solve boxes with sequential cuts, so they only build on
+    // labels sequential cuts gave
+    const bool sequential = !multi_label_ and stroke_threshold_ == 0 and superpixel_size_ == 0;
+    if (repaint_margin_ > 0 and sequential and !seeds_.empty()) {
+        // previews since the last paint put its labels aside
+        if (!repaint_labels_.empty()) {
+            labels_.swap(repaint_labels_);
+            palette_.swap(repaint_palette_);
+            repaint_labels_.clear();
+            repaint_palette_.clear();
+        }
+        repaint(scribbles);
+    }
+    else {
+        // pixels left unpainted show the drawing, not an earlier paint
+        clear_labels();
+        paint_labels(scribbles);
+        if (repaint_margin_ > 0 and sequential)
+            seeds_ = palette_seeds(scribbles);
+    }
+    // a cancelled paint leaves labels that can't be repainted
+    if (cancel_)
+        seeds_.clear();
+}
+
+Painter::~Painter() {
+    cancel_paint();
+}
+
+void Painter::paint_async(
+        const Matrix<unsigned char>& scribbles,
+        std::function<void(int done, int colors)> progress)
+{
+    cancel_paint();
+    working_ = true;
+    progress_ = std::move(progress);
+    worker_ = std::thread([this, scribbles = scribbles.copy()]() mutable {
+        async_ = true;
+        segment(scribbles);
+        composite(drawing_painted_);
+        composite(snapshot_back_);
+        publish();
+        if (progress_ and !cancel_)
+            progress_(palette_.size(), palette_.size());
+        async_ = false;
+        working_ = false;
+    });
+}
+
+void Painter::cancel_paint() {
+    if (!worker_.joinable())
+        return;
+    cancel_ = true;
+    worker_.join();
+    cancel_ = false;
+}
+
+void Painter::wait_paint() {
+    if (worker_.joinable())
+        worker_.join();
+}
+
+bool Painter::color_done(int done, int colors) {
+    if (async_) {
+        composite(snapshot_back_);
+        publish();
+        if (progress_)
+            progress_(done, colors);
+    }
+    return !cancel_;
+}
+
+void Painter::publish() {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    snapshot_.swap(snapshot_back_);
+    ++snapshot_version_;
+}
+
+bool Painter::read_snapshot(
+        int& version,
+        const std::function<void(const Matrix<unsigned char>&)>& read)
+{
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    if (version == snapshot_version_)
+        return false;
+    version = snapshot_version_;
+    read(snapshot_);
+    return true;
+}
+
+void Painter::paint_labels(Matrix<unsigned char>& scribbles) {
+    assert(scribbles.channels() == 4 and scribbles.size() / 4 == gray_.size());
+    if (multi_label_)
+        return paint_multi_label(scribbles);
+    if (stroke_threshold_ > 0)
+        return paint_regions(scribbles);
+    if (pyramid_levels_ > 0)
+        return paint_pyramid(scribbles);
+    if (tile_size_ > 0)
+        return paint_tiled(scribbles);
+    if (superpixel_size_ > 0)
+        return paint_superpixels(scribbles);
+    if (incremental_ and solver_ == Solver::BOYKOV_KOLMOGOROV)
+        return paint_incremental(scribbles);
+    switch (solver_) {
+    case Solver::DINIC:
+        // residuals of pixel edges fit 16 bits unless terminals are huge
+        if (terminal_capacity_ <= std::numeric_limits<std::uint16_t>::max())
+            return label_with<Dinic<int, std::uint16_t>>(scribbles);
+        return label_with<Dinic<int>>(scribbles);
+    case Solver::EDMONDS_KARP:
+        return label_with<EdmondsKarp<int>>(scribbles);
+    case Solver::BOYKOV_KOLMOGOROV:
+        return label_with<BoykovKolmogorov<int, GridGraph<int>>>(scribbles);
+    case Solver::PUSH_RELABEL:
+        return label_with<PushRelabel<int, GridGraph<int>>>(scribbles);
+    }
+}
+
+// grid solvers get the image shape, others a plain node count
+template <class graph_t>
+auto make_graph(const Matrix<unsigned char>& gray) -> graph_t {
+    if constexpr (runs_on_grid_v<graph_t>)
+        return graph_t(gray.height(), gray.width());
+    else
+        return graph_t(gray.size() + 2);
+}
+
+template <class graph_t>
+struct Painter::GraphSlot : Painter::GraphArena {
+    explicit GraphSlot(const Matrix<unsigned char>& gray)
+        : graph(make_graph<graph_t>(gray))
+    { }
+
+    graph_t graph;
+};
+
+template <class graph_t>
+auto Painter::reusable_graph() -> graph_t& {
+    auto* slot = dynamic_cast<GraphSlot<graph_t>*>(arena_.get());
+    bool fits = slot and slot->graph.V() == static_cast<int>(gray_.size()) + 2;
+    if constexpr (runs_on_grid_v<graph_t>)
+        fits = fits and slot->graph.graph().width() == static_cast<int>(gray_.width());
+    if (fits) {
+        slot->graph.clear();
+        return slot->graph;
+    }
+    arena_.reset();
+    arena_ = std::make_unique<GraphSlot<graph_t>>(gray_);
+    return static_cast<GraphSlot<graph_t>&>(*arena_).graph;
+}
+
+template <class graph_t, class = void>
+struct is_threaded : std::false_type {};
+template <class graph_t>
+struct is_threaded<graph_t, std::void_t<decltype(std::declval<graph_t&>().set_threads(0))>>
+    : std::true_type {};
+
+template <class graph_t, class = void>
+struct has_builder : std::false_type {};
+template <class graph_t>
+struct has_builder<graph_t, std::void_t<decltype(std::declval<graph_t&>().reserve_edges(0, 0))>>
+    : std::true_type {};
 
-    auto pixels = gray_.size();
+template <class graph_t>
+void Painter::paint_with(Matrix<unsigned char>& scribbles) {
+    clear_labels();
+    label_with<graph_t>(scribbles);
+    composite(drawing_painted_);
+}
+
+template <class graph_t>
+void Painter::label_with(Matrix<unsigned char>& scribbles) {
+    const int pixels = gray_.size();
     std::vector<bool> used_pixels(pixels);
-    std::unordered_set<unsigned int> used_colors;
-    used_colors.insert(color_to_int(default_color));
-    std::array<u_char, 3> new_color {};
+    auto index = index_scribbles(scribbles);
+    palette_ = index.palette;
+    std::vector<signed char> terminals(pixels);
+    for (int i : index.pixels)
+        terminals[i] = -1;
+
+    node_of_pixel_.clear();
+    if constexpr (!runs_on_grid_v<graph_t>)
+        if (node_order_ != NodeOrder::RASTER)
+            node_of_pixel_ = node_numbering(gray_.height(), gray_.width(), node_order_);
+
+    const int colors = index.palette.size();
+    for (int color = 0; color != colors; ++color) {
+        auto& graph = reusable_graph<graph_t>();
+        if constexpr (is_threaded<graph_t>::value)
+            graph.set_threads(threads_);
+
+        mark_terminals(index, color, terminals);
+        if constexpr (has_builder<graph_t>::value) {
+            if (!has_drawing_edges(used_pixels)) {
+                break;
+            }
+            build_graph(graph, used_pixels, terminals);
+        }
+        else {
+            if (!add_drawing_edges(graph, used_pixels)) {
+                break;
+            }
+            add_scribbles_edges(graph, index, terminals);
+        }
+
+        if (async_)
+            graph.set_stop([this] { return bool(cancel_); });
+        graph.max_flow(pixels, pixels + 1);
+        if (graph.stopped())
+            break;
+        auto partition = graph.partition(pixels);
+        if (!node_of_pixel_.empty()) {
+            std::vector<bool> raster(pixels);
+            for (int i = 0; i != pixels; ++i)
+                raster[i] = partition[node(i)];
+            partition.swap(raster);
+        }
+
+        // later colors win, like blending in cut order did
+        for (int i = 0; i != pixels; ++i) {
+            if (partition[i]) {
+                labels_[i] = color;
+                used_pixels[i] = true;
+            }
+        }
+        if (!color_done(color + 1, index.palette.size()))
+            break;
+    }
+}
+
+// Regions are 4-connected components of pixels not darker than
+// stroke_threshold_, stroke pixels join the nearest region. Regions
+// without scribbles are grouped with their neighbours, so they end up
+// with the color around them. Groups with a single color are filled,
+// groups with several are independent cut problems.
+void Painter::paint_regions(Matrix<unsigned char>& scribbles) {
+    assert(!scribbles.empty());
+    assert(scribbles.channels() == 4);
+    assert(scribbles.size() / 4 == gray_.size());
+
+    const int size = gray_.size();
+    const int width = gray_.width();
+    auto* pt = gray_.pt();
+    const int none = -1;
+
+    auto neighbours = [&](int i, auto&& fn) {
+        if (i % width) fn(i - 1);
+        if ((i + 1) % width) fn(i + 1);
+        if (i >= width) fn(i - width);
+        if (i + width < size) fn(i + width);
+    };
+
+    // components of light pixels
+    std::vector<int> region(size, none);
+    std::vector<int> queue;
+    queue.reserve(size);
+    int regions = 0;
+    for (int i = 0; i != size; ++i) {
+        if (region[i] != none or pt[i] < stroke_threshold_)
+            continue;
+        region[i] = regions;
+        int q_start = queue.size();
+        queue.push_back(i);
+        while (q_start != static_cast<int>(queue.size())) {
+            neighbours(queue[q_start++], [&](int j) {
+                if (region[j] == none and pt[j] >= stroke_threshold_) {
+                    region[j] = regions;
+                    queue.push_back(j);
+                }
+            });
+        }
+        ++regions;
+    }
+    if (regions == 0) {
+        return label_with<BoykovKolmogorov<int, GridGraph<int>>>(scribbles);
+    }
+
+    // strokes go to the nearest region
+    for (size_t q_start = 0; q_start != queue.size(); ++q_start) {
+        int cur = queue[q_start];
+        neighbours(cur, [&](int j) {
+            if (region[j] == none) {
+                region[j] = region[cur];
+                queue.push_back(j);
+            }
+        });
+    }
+
+    // scribble colors of every region: none, one or mixed
+    auto seeds = scribble_seeds(scribbles, palette_);
+    const int colors = palette_.size();
+    const int mixed = -2;
+    std::vector<int> color(regions, none);
+    for (int i = 0; i != size; ++i) {
+        if (seeds[i] < 0)
+            continue;
+        int c = seeds[i];
+        auto& rc = color[region[i]];
+        if (rc == none)
+            rc = c;
+        else if (rc != c)
+            rc = mixed;
+    }
+
+    // union-find, regions without scribbles join their neighbours
+    std::vector<int> group(regions);
+    for (int r = 0; r != regions; ++r)
+        group[r] = r;
+    auto find = [&](int r) {
+        while (group[r] != r)
+            r = group[r] = group[group[r]];
+        return r;
+    };
+    for (int i = 0; i != size; ++i) {
+        auto join = [&](int j) {
+            int a = region[i], b = region[j];
+            if (a == b or (color[a] != none and color[b] != none))
+                return;
+            a = find(a);
+            b = find(b);
+            if (a != b)
+                group[b] = a;
+        };
+        if (i % width) join(i - 1);
+        if (i >= width) join(i - width);
+    }
+
+    std::vector<int> group_color(regions, none);
+    for (int r = 0; r != regions; ++r) {
+        auto& gc = group_color[find(r)];
+        if (color[r] == none or gc == mixed)
+            continue;
+        gc = gc == none or gc == color[r] ? color[r] : mixed;
+    }
+
+    // pixels of groups that need a cut, in raster order
+    std::vector<int> solve_id(regions, none);
+    std::vector<std::vector<int>> groups;
+    for (int i = 0; i != size; ++i) {
+        int g = find(region[i]);
+        auto c = group_color[g];
+        if (c == none or c == colors)
+            continue;
+        if (c != mixed) {
+            labels_[i] = c;
+            continue;
+        }
+        if (solve_id[g] == none) {
+            solve_id[g] = groups.size();
+            groups.emplace_back();
+        }
+        groups[solve_id[g]].push_back(i);
+    }
+
+    // biggest first, threads take the next group when done
+    std::sort(groups.begin(), groups.end(), [](auto& a, auto& b) { return a.size() > b.size(); });
+    std::atomic<int> next {0};
+    pool().parallel_for(pool().size(), [&](int, int, int) {
+        for (int g = next++; g < int(groups.size()) and !cancel_; g = next++)
+            paint_region(groups[g], seeds, colors);
+    });
+}
+
+void Painter::paint_region(
+        const std::vector<int>& pixels,
+        const std::vector<int>& seeds,
+        int colors)
+{
+    const int width = gray_.width();
+
+    // bounding box
+    int x0 = width, x1 = 0;
+    int y0 = pixels.front() / width, y1 = pixels.back() / width;
+    for (int i : pixels) {
+        x0 = std::min(x0, i % width);
+        x1 = std::max(x1, i % width);
+    }
+    const int w = x1 - x0 + 1;
+    const int size = w * (y1 - y0 + 1);
+    auto local = [&](int i) { return (i / width - y0) * w + i % width - x0; };
+
+    // pixels outside of the region count as used
+    std::vector<bool> used(size, true);
+    for (int i : pixels)
+        used[local(i)] = false;
+
+    auto* pt = gray_.pt();
+    unsigned char zero_cancel = 1;
+    // the default color is never cut
+    std::vector<char> used_colors(colors + 1);
+    used_colors[colors] = true;
 
     while (true) {
-        Dinic<int> graph(pixels + 2);
+        BoykovKolmogorov<int, GridGraph<int>> graph(y1 - y0 + 1, w);
+        auto& grid = graph.graph();
 
-        if (!add_drawing_edges(graph, used_pixels)) {
+        bool new_edge_added = false;
+        for (int i : pixels) {
+            int j = local(i);
+            if (used[j])
+                continue;
+            if (j % w and !used[j-1]) {
+                new_edge_added = true;
+                grid.set_horizontal(j-1, std::max(zero_cancel, std::min(pt[i], pt[i-1])));
+            }
+            if (j >= w and !used[j-w]) {
+                new_edge_added = true;
+                grid.set_vertical(j-w, std::max(zero_cancel, std::min(pt[i], pt[i-width])));
+            }
+        }
+        if (!new_edge_added) {
+            // colors left only repaint their own scribbles, like the
+            // isolated sources of a global cut
+            for (int i : pixels)
+                if (seeds[i] >= 0 and !used_colors[seeds[i]])
+                    labels_[i] = seeds[i];
             break;
         }
-        if (!add_scribbles_edges(graph, used_colors, new_color, scribbles)) {
+
+        // same color order as a global paint: lowest palette index first
+        int new_color = colors;
+        for (int i : pixels)
+            if (seeds[i] >= 0 and !used_colors[seeds[i]])
+                new_color = std::min(new_color, seeds[i]);
+        if (new_color == colors)
             break;
+        used_colors[new_color] = true;
+
+        for (int i : pixels) {
+            int c = seeds[i];
+            if (c < 0)
+                continue;
+            if (c == new_color)
+                grid.add_source_capacity(local(i), terminal_capacity_);
+            else
+                grid.add_sink_capacity(local(i), terminal_capacity_);
+        }
+
+        if (async_)
+            graph.set_stop([this] { return bool(cancel_); });
+        graph.max_flow(size, size + 1);
+        if (graph.stopped())
+            break;
+        auto partition = graph.partition(size);
+
+        for (int i : pixels) {
+            int j = local(i);
+            if (!partition[j])
+                continue;
+            labels_[i] = new_color;
+            used[j] = true;
+        }
+    }
+}
+
+auto Painter::scribble_palette(
+        const Matrix<unsigned char>& scribbles,
+        std::vector<std::array<u_char, 3>>& palette) -> std::unordered_map<unsigned int, int>
+{
+    assert(scribbles.channels() == 4);
+
+    const int size = scribbles.size() / 4;
+    const auto default_color = color_to_int({255, 255, 255});
+    auto* pt = scribbles.pt();
+
+    std::unordered_map<unsigned int, int> index;
+    for (int i = 0; i != size; ++i) {
+        if (pt[4*i+3] == 0)
+            continue;
+        std::array<u_char, 3> color {pt[4*i], pt[4*i+1], pt[4*i+2]};
+        auto c = color_to_int(color);
+        if (c == default_color)
+            continue;
+        auto [it, added] = index.emplace(c, palette.size());
+        if (added)
+            palette.push_back(color);
+    }
+    index[default_color] = palette.size();
+    return index;
+}
+
+// palette index of the scribble at pixel i, -1 without one
+static auto scribble_at(
+        const Matrix<unsigned char>& scribbles,
+        const std::unordered_map<unsigned int, int>& index,
+        int i) -> int
+{
+    auto* p = scribbles.pt() + 4 * i;
+    return p[3] == 0 ? -1 : index.at(color_to_int({p[0], p[1], p[2]}));
+}
+
+auto Painter::scribble_seeds(
+        Matrix<unsigned char>& scribbles,
+        std::vector<std::array<u_char, 3>>& palette) -> std::vector<int>
+{
+    const auto index = scribble_palette(scribbles, palette);
+    std::vector<int> seeds(scribbles.size() / 4);
+    for (size_t i = 0; i != seeds.size(); ++i)
+        seeds[i] = scribble_at(scribbles, index, i);
+    return seeds;
+}
+
+// counting sort of the seeds by color
+auto Painter::index_scribbles(Matrix<unsigned char>& scribbles) -> ScribbleIndex {
+    ScribbleIndex index;
+    auto seeds = scribble_seeds(scribbles, index.palette);
+    const int colors = index.palette.size();
+
+    index.offset.assign(colors + 2, 0);
+    for (int seed : seeds)
+        if (seed >= 0)
+            ++index.offset[seed + 1];
+    for (int c = 0; c <= colors; ++c)
+        index.offset[c + 1] += index.offset[c];
+
+    index.pixels.resize(index.offset.back());
+    auto next = index.offset;
+    for (size_t i = 0; i != seeds.size(); ++i)
+        if (seeds[i] >= 0)
+            index.pixels[next[seeds[i]]++] = i;
+    return index;
+}
+
+template <class F>
+static void for_neighbours(int i, int width, int size, F&& fn) {
+    if (i % width) fn(i - 1);
+    if ((i + 1) % width) fn(i + 1);
+    if (i >= width) fn(i - width);
+    if (i + width < size) fn(i + width);
+}
+
+// square dilation, rows first and then columns, each by the distance
+// to the closest set pixel of the line
+static void dilate(std::vector<bool>& mask, int height, int width, int radius) {
+    const int size = height * width;
+    std::vector<int> distance(size);
+    for (int pass = 0; pass != 2; ++pass) {
+        const int step = pass == 0 ? 1 : width;
+        const int lines = pass == 0 ? height : width;
+        const int length = pass == 0 ? width : height;
+        for (int line = 0; line != lines; ++line) {
+            const int first = pass == 0 ? line * width : line;
+            int last = -size;
+            for (int k = 0; k != length; ++k) {
+                if (mask[first + k * step])
+                    last = k;
+                distance[first + k * step] = k - last;
+            }
+            last = 2 * size;
+            for (int k = length - 1; k >= 0; --k) {
+                int i = first + k * step;
+                if (mask[i])
+                    last = k;
+                distance[i] = std::min(distance[i], last - k);
+            }
+            for (int k = 0; k != length; ++k) {
+                int i = first + k * step;
+                mask[i] = distance[i] <= radius;
+            }
+        }
+    }
+}
+
+// pixels within radius of a label boundary and every pixel connected
+// through equal labels to a scribble of another color, which a coarser
+// solve lost
+static auto refine_band(
+        const std::vector<int>& seeds,
+        const std::vector<int>& labels,
+        int height,
+        int width,
+        int radius) -> std::vector<bool>
+{
+    const int size = height * width;
+    std::vector<bool> band(size);
+    for (int i = 0; i != size; ++i) {
+        band[i] = ((i + 1) % width and labels[i + 1] != labels[i])
+            or (i + width < size and labels[i + width] != labels[i]);
+    }
+
+    std::vector<bool> flooded(size);
+    std::vector<int> queue;
+    for (int i = 0; i != size; ++i) {
+        if (seeds[i] < 0 or seeds[i] == labels[i] or flooded[i])
+            continue;
+        flooded[i] = true;
+        queue.assign(1, i);
+        for (size_t k = 0; k != queue.size(); ++k) {
+            const int p = queue[k];
+            for_neighbours(p, width, size, [&](int q) {
+                if (!flooded[q] and labels[q] == labels[p]) {
+                    flooded[q] = true;
+                    queue.push_back(q);
+                }
+            });
         }
-        used_colors.insert(color_to_int(new_color));
+    }
+    for (int i = 0; i != size; ++i)
+        band[i] = band[i] or flooded[i];
+    dilate(band, height, width, radius);
+    return band;
+}
+
+void Painter::label_cuts(
+        const Matrix<unsigned char>& gray,
+        const std::vector<int>& seeds,
+        int colors,
+        std::vector<int>& labels,
+        const std::vector<bool>& free,
+        const std::vector<int>& seed_weight,
+        int edge_scale)
+{
+    const int size = gray.size();
+    const int width = gray.width();
+    auto* pt = gray.pt();
+    unsigned char zero_cancel = 1;
+    auto weight = [&](int p, int q) -> int {
+        return edge_scale * std::max(zero_cancel, std::min(pt[p], pt[q]));
+    };
+    auto terminal = [&](int p) {
+        return terminal_capacity_ * (seed_weight.empty() ? 1 : seed_weight[p]);
+    };
+
+    std::vector<int> active;
+    for (int i = 0; i != size; ++i) {
+        if (free[i]) {
+            labels[i] = colors;
+            active.push_back(i);
+        }
+    }
+    std::vector<int> node(size, -1);
+
+    for (int color = 0; color != colors and !active.empty() and !cancel_; ++color) {
+        const int n = active.size();
+        for (int id = 0; id != n; ++id)
+            node[active[id]] = id;
+
+        BoykovKolmogorov<int> graph(n + 2);
+        bool has_source = false;
+        for (int id = 0; id != n; ++id) {
+            const int p = active[id];
+            for_neighbours(p, width, size, [&](int q) {
+                if (node[q] >= 0) {
+                    // each pair once
+                    if (q < p)
+                        graph.add_bidirectional_edge(id, node[q], weight(p, q));
+                }
+                else if (!free[q] and labels[q] == color) {
+                    graph.add_directional_edge(n, id, weight(p, q));
+                    has_source = true;
+                }
+                else if (!free[q] and labels[q] > color) {
+                    graph.add_directional_edge(id, n + 1, weight(p, q));
+                }
+            });
+            if (seeds[p] == color) {
+                graph.add_directional_edge(n, id, terminal(p));
+                has_source = true;
+            }
+            else if (seeds[p] >= 0) {
+                graph.add_directional_edge(id, n + 1, terminal(p));
+            }
+        }
+
+        if (has_source) {
+            if (async_)
+                graph.set_stop([this] { return bool(cancel_); });
+            graph.max_flow(n, n + 1);
+            if (graph.stopped())
+                break;
+            auto partition = graph.partition(n);
+            for (int id = 0; id != n; ++id)
+                if (partition[id])
+                    labels[active[id]] = color;
+        }
+
+        for (int p : active)
+            node[p] = -1;
+        active.erase(
+                std::remove_if(active.begin(), active.end(), [&](int p) { return labels[p] != colors; }), 
+                active.end());
+    }
+}
+
+auto Painter::halve(
+        const Matrix<unsigned char>& gray,
+        const std::function<int(int)>& seed_at,
+        const std::vector<int>& weight,
+        int colors) -> Level
+{
+    const int h = gray.height(), w = gray.width();
+    const int ch = (h + 1) / 2, cw = (w + 1) / 2;
+    Level coarse {Matrix<unsigned char>(ch, cw, 1, 255), std::vector<int>(ch * cw, -1), std::vector<int>(ch * cw)};
+    auto* pt = coarse.gray.pt();
+    std::vector<int> count(colors + 1);
+    for (int cy = 0; cy != ch; ++cy) {
+        for (int cx = 0; cx != cw; ++cx) {
+            const int c = cy * cw + cx;
+            for (int y = 2 * cy; y != std::min(2 * cy + 2, h); ++y) {
+                for (int x = 2 * cx; x != std::min(2 * cx + 2, w); ++x) {
+                    const int i = y * w + x;
+                    pt[c] = std::min(pt[c], gray.pt()[i]);
+                    const int seed = seed_at(i);
+                    if (seed < 0)
+                        continue;
+                    count[seed] += weight.empty() ? 1 : weight[i];
+                    if (coarse.seeds[c] < 0 or count[seed] > count[coarse.seeds[c]])
+                        coarse.seeds[c] = seed;
+                }
+            }
+            if (coarse.seeds[c] < 0)
+                continue;
+            coarse.weight[c] = count[coarse.seeds[c]];
+            for (int y = 2 * cy; y != std::min(2 * cy + 2, h); ++y)
+                for (int x = 2 * cx; x != std::min(2 * cx + 2, w); ++x)
+                    if (int seed = seed_at(y * w + x); seed >= 0)
+                        count[seed] = 0;
+        }
+    }
+    return coarse;
+}
+
+auto Painter::pyramid(const std::vector<int>& seeds, int colors, int levels) const -> std::vector<Level> {
+    std::vector<Level> result;
+    for (int level = 0; level != levels; ++level) {
+        auto& gray = result.empty() ? gray_ : result.back().gray;
+        if (gray.height() < 2 or gray.width() < 2)
+            break;
+        auto& fine_seeds = result.empty() ? seeds : result.back().seeds;
+        auto seed_at = [&fine_seeds](int i) { return fine_seeds[i]; };
+        result.push_back(result.empty()
+                ? halve(gray_, seed_at, {}, colors)
+                : halve(gray, seed_at, result.back().weight, colors));
+    }
+    return result;
+}
+
+auto Painter::coarse_labels(
+        const std::vector<int>& seeds,
+        const std::vector<Level>& levels,
+        int colors) -> std::vector<int>
+{
+    if (levels.empty()) {
+        std::vector<int> labels(seeds.size());
+        label_cuts(gray_, seeds, colors, labels, std::vector<bool>(labels.size(), true));
+        return labels;
+    }
+    auto& top = levels.back();
+    std::vector<int> labels(top.gray.size());
+    label_cuts(
+            top.gray, top.seeds, colors, labels,
+            std::vector<bool>(labels.size(), true), top.weight, 1 << levels.size());
+    return labels;
+}
+
+// Gray levels are min-pooled so thin strokes survive downsampling. A
+// coarse pixel stands for 2^level fine pixels a side, so its scribble
+// weighs the scribble pixels of its color in the block and its edges
+// scale by the side, which keeps the coarse cut the cost of the fine
+// one. Every finer level re-solves a band around label boundaries and
+// the regions holding scribbles the coarse labels disagree with, the
+// rest keeps the upsampled labels.
+void Painter::paint_pyramid(Matrix<unsigned char>& scribbles) {
+    assert(!scribbles.empty());
+    assert(scribbles.size() / 4 == gray_.size());
+
+    const int band_radius = 2;
+
+    std::vector<std::array<u_char, 3>> palette;
+    auto seeds = scribble_seeds(scribbles, palette);
+    const int colors = palette.size();
+
+    auto levels = pyramid(seeds, colors, pyramid_levels_);
+    auto labels = coarse_labels(seeds, levels, colors);
+
+    // full resolution seeds weigh one each
+    const std::vector<int> one_each;
+    for (int level = levels.size() - 1; level >= 0; --level) {
+        auto& gray = level == 0 ? gray_ : levels[level - 1].gray;
+        auto& level_seeds = level == 0 ? seeds : levels[level - 1].seeds;
+        auto& weight = level == 0 ? one_each : levels[level - 1].weight;
+        const int h = gray.height(), w = gray.width(), size = h * w;
+        const int cw = levels[level].gray.width();
+
+        std::vector<int> fine(size);
+        for (int i = 0; i != size; ++i)
+            fine[i] = labels[(i / w / 2) * cw + (i % w) / 2];
+
+        auto band = refine_band(level_seeds, fine, h, w, band_radius);
+        label_cuts(gray, level_seeds, colors, fine, band, weight, 1 << level);
+        labels.swap(fine);
+    }
 
-        auto flow = graph.max_flow(pixels, pixels + 1);
-        std::cout << "flow=" << flow << '\n';
+    set_labels(labels, palette);
+}
+
+// The drawing is halved until one tile covers it, and that level is cut
+// whole to carry colors across tiles without scribbles. Every finer
+// level starts from the labels of the coarser one and re-solves the core
+// of each tile grown by a halo, with the ring around the halo fixed to
+// the labels so far. Tiles whose core changes send their neighbours
+// through another sweep until nothing changes. Tiles of one parity class
+// are two tiles apart and never read pixels another job of the pass
+// writes, so passes run in parallel. Every graph is one window, full
+// resolution seeds are read from the scribbles per window and labels are
+// written in place into labels_. The coarse levels take about 3 bytes
+// per pixel of the drawing.
+void Painter::paint_tiled(Matrix<unsigned char>& scribbles) {
+    assert(!scribbles.empty());
+    assert(scribbles.size() / 4 == gray_.size());
+
+    const int tile = std::max(tile_size_, 32);
+    const int halo = std::max(8, tile / 8);
+
+    std::vector<std::array<u_char, 3>> palette;
+    const auto index = scribble_palette(scribbles, palette);
+    const int colors = palette.size();
+    palette_ = palette;
+
+    // deeper coarse levels can merge paper up to 7 pixels wide into the
+    // strokes around it, so they are only taken to keep the whole level
+    // cut within the area of a few tiles
+    const int max_halvings = 2;
+    const int budget = 16 * tile * tile;
+
+    // levels[k] is halved k + 1 times
+    std::vector<Level> levels;
+    auto level_gray = [&](int k) -> const Matrix<unsigned char>& {
+        return k == 0 ? gray_ : levels[k - 1].gray;
+    };
+    auto seed_of = [&](int k) -> std::function<int(int)> {
+        if (k == 0)
+            return [&](int i) { return scribble_at(scribbles, index, i); };
+        return [&seeds = levels[k - 1].seeds](int i) { return seeds[i]; };
+    };
+    for (int k = 0; level_gray(k).height() >= 2 and level_gray(k).width() >= 2; ++k) {
+        auto& gray = level_gray(k);
+        const bool fits = gray.height() <= tile and gray.width() <= tile;
+        if ((k == max_halvings or fits) and int(gray.size()) <= budget)
+            break;
+        auto level = halve(gray, seed_of(k), k == 0 ? std::vector<int>() : levels[k - 1].weight, colors);
+        levels.push_back(std::move(level));
+    }
+
+    auto run = [&](int jobs, auto&& job) {
+        std::atomic<int> next {0};
+        pool().parallel_for(pool().size(), [&](int, int, int) {
+            for (int j = next++; j < jobs; j = next++)
+                job(j);
+        });
+    };
+
+    const std::vector<int> one_each;
+    std::vector<std::uint16_t> coarse, fine;
+    for (int k = levels.size(); k >= 0 and !cancel_; --k) {
+        auto& gray = level_gray(k);
+        const int width = gray.width();
+        const int height = gray.height();
+        auto& weight = k == 0 ? one_each : levels[k - 1].weight;
+        const auto seed_at = seed_of(k);
+
+        auto& labels = k == 0 ? labels_ : fine;
+        labels.assign(gray.size(), unlabeled);
+        if (!coarse.empty()) {
+            const int cw = level_gray(k + 1).width();
+            for (int y = 0; y != height; ++y)
+                for (int x = 0; x != width; ++x)
+                    labels[y * width + x] = coarse[(y / 2) * cw + x / 2];
+        }
+
+        // the coarsest level is cut whole
+        const int step = k == int(levels.size()) ? std::max(width, height) : tile;
+        const int columns = (width + step - 1) / step;
+        const int rows = (height + step - 1) / step;
+        std::vector<char> dirty(columns * rows, 1), changed(columns * rows);
+        for (int sweep = 0; sweep <= columns + rows and !cancel_; ++sweep) {
+            bool any = false;
+            for (int parity = 0; parity != 4; ++parity) {
+                std::vector<int> jobs;
+                for (int t = 0; t != columns * rows; ++t)
+                    if (dirty[t] and (t % columns % 2) + 2 * (t / columns % 2) == parity)
+                        jobs.push_back(t);
+                run(jobs.size(), [&](int j) {
+                    int t = jobs[j];
+                    Box c {t % columns * step, t / columns * step, 0, 0};
+                    c.x1 = std::min(c.x0 + step, width);
+                    c.y1 = std::min(c.y0 + step, height);
+                    Box free {c.x0 - halo, c.y0 - halo, c.x1 + halo, c.y1 + halo};
+                    Box window {free.x0 - 1, free.y0 - 1, free.x1 + 1, free.y1 + 1};
+                    changed[t] = solve_window(
+                            window, free, c, gray, seed_at, weight, 1 << k, colors, labels);
+                });
+                for (int t : jobs) {
+                    dirty[t] = 0;
+                    if (!changed[t])
+                        continue;
+                    any = true;
+                    int x = t % columns, y = t / columns;
+                    if (x > 0) dirty[t - 1] = 1;
+                    if (x + 1 < columns) dirty[t + 1] = 1;
+                    if (y > 0) dirty[t - columns] = 1;
+                    if (y + 1 < rows) dirty[t + columns] = 1;
+                }
+            }
+            if (!any)
+                break;
+        }
+        coarse.swap(fine);
+    }
+}
+
+auto Painter::solve_window(
+        Box window, Box free, Box keep,
+        const Matrix<unsigned char>& gray,
+        const std::function<int(int)>& seed_at,
+        const std::vector<int>& weight,
+        int edge_scale,
+        int colors,
+        std::vector<std::uint16_t>& labels) -> bool
+{
+    const int width = gray.width();
+    auto clamp = [&](Box& b) {
+        b.x0 = std::max(b.x0, 0);
+        b.y0 = std::max(b.y0, 0);
+        b.x1 = std::min<int>(b.x1, width);
+        b.y1 = std::min<int>(b.y1, gray.height());
+    };
+    clamp(window);
+    const int w = window.x1 - window.x0;
+    const int h = window.y1 - window.y0;
+    if (w <= 0 or h <= 0)
+        return false;
+
+    auto inside = [](const Box& b, int x, int y) {
+        return b.x0 <= x and x < b.x1 and b.y0 <= y and y < b.y1;
+    };
+
+    Matrix<unsigned char> crop(h, w, 1);
+    std::vector<int> crop_seeds(w * h), crop_labels(w * h), crop_weight;
+    if (!weight.empty())
+        crop_weight.resize(w * h);
+    std::vector<bool> crop_free(w * h);
+    for (int y = 0; y != h; ++y) {
+        for (int x = 0; x != w; ++x) {
+            int i = (window.y0 + y) * width + window.x0 + x;
+            int j = y * w + x;
+            crop.pt()[j] = gray.pt()[i];
+            crop_seeds[j] = seed_at(i);
+            if (!weight.empty())
+                crop_weight[j] = weight[i];
+            crop_free[j] = inside(free, window.x0 + x, window.y0 + y);
+            // free labels may be written by other windows meanwhile
+            crop_labels[j] = crop_free[j] or labels[i] == unlabeled ? colors : labels[i];
+        }
+    }
+
+    label_cuts(crop, crop_seeds, colors, crop_labels, crop_free, crop_weight, edge_scale);
+    if (cancel_)
+        return false;
+
+    bool changed = false;
+    for (int y = 0; y != h; ++y) {
+        for (int x = 0; x != w; ++x) {
+            if (!inside(keep, window.x0 + x, window.y0 + y))
+                continue;
+            const int label = crop_labels[y * w + x];
+            auto& pixel = labels[(window.y0 + y) * width + window.x0 + x];
+            const std::uint16_t next = label < colors ? label : unlabeled;
+            changed |= pixel != next;
+            pixel = next;
+        }
+    }
+    return changed;
+}
+
+auto Painter::palette_seeds(Matrix<unsigned char>& scribbles) -> std::vector<int> {
+    std::vector<std::array<u_char, 3>> palette;
+    auto seeds = scribble_seeds(scribbles, palette);
+    for (auto& seed : seeds)
+        if (seed == static_cast<int>(palette.size()))
+            seed = unlabeled;
+
+    // previous colors without scribbles go last
+    std::unordered_map<unsigned int, int> index;
+    for (size_t k = 0; k != palette.size(); ++k)
+        index.emplace(color_to_int(palette[k]), k);
+    std::vector<int> to(palette_.size());
+    for (size_t k = 0; k != palette_.size(); ++k) {
+        auto [it, added] = index.emplace(color_to_int(palette_[k]), palette.size());
+        if (added)
+            palette.push_back(palette_[k]);
+        to[k] = it->second;
+    }
+    for (auto& label : labels_)
+        if (label != unlabeled)
+            label = to[label];
+    for (auto& seed : seeds_)
+        if (seed >= 0 and seed != unlabeled)
+            seed = to[seed];
+    palette_.swap(palette);
+    return seeds;
+}
+
+// A changed scribble can move labels of the previous region it lies in,
+// so every such region is flooded and its bounding box, grown by
+// repaint_margin_, is re-solved with label_cuts. Overlapping boxes merge
+// first. Pixels around a box keep their labels and act as sources or
+// sinks, like the fixed labels of the other windowed solves.
+void Painter::repaint(Matrix<unsigned char>& scribbles) {
+    assert(scribbles.size() / 4 == gray_.size());
+
+    const int size = gray_.size();
+    const int width = gray_.width();
+    const int height = gray_.height();
+    auto seeds = palette_seeds(scribbles);
+    const int colors = palette_.size();
+    if (colors >= unlabeled) {
+        // labels would not fit the plane, paint everything instead
+        clear_labels();
+        paint_labels(scribbles);
+        seeds_ = palette_seeds(scribbles);
+        return;
+    }
+
+    std::vector<Box> boxes;
+    std::vector<char> flooded(size);
+    std::vector<int> stack;
+    for (int i = 0; i != size; ++i) {
+        if (seeds[i] == seeds_[i] or flooded[i])
+            continue;
+        Box box {i % width, i / width, i % width + 1, i / width + 1};
+        flooded[i] = true;
+        stack.push_back(i);
+        while (!stack.empty()) {
+            int p = stack.back();
+            stack.pop_back();
+            box.x0 = std::min(box.x0, p % width);
+            box.x1 = std::max(box.x1, p % width + 1);
+            box.y0 = std::min(box.y0, p / width);
+            box.y1 = std::max(box.y1, p / width + 1);
+            for_neighbours(p, width, size, [&](int q) {
+                if (!flooded[q] and labels_[q] == labels_[p]) {
+                    flooded[q] = true;
+                    stack.push_back(q);
+                }
+            });
+        }
+        box.x0 = std::max(box.x0 - repaint_margin_, 0);
+        box.y0 = std::max(box.y0 - repaint_margin_, 0);
+        box.x1 = std::min(box.x1 + repaint_margin_, width);
+        box.y1 = std::min(box.y1 + repaint_margin_, height);
+        boxes.push_back(box);
+    }
+    seeds_ = seeds;
+
+    // merged boxes never overlap, so their solves are independent
+    for (bool merged = true; merged; ) {
+        merged = false;
+        for (size_t a = 0; a != boxes.size(); ++a) {
+            for (size_t b = a + 1; b != boxes.size(); ++b) {
+                auto& p = boxes[a];
+                auto& q = boxes[b];
+                if (p.x1 <= q.x0 or q.x1 <= p.x0 or p.y1 <= q.y0 or q.y1 <= p.y0)
+                    continue;
+                p = {std::min(p.x0, q.x0), std::min(p.y0, q.y0),
+                     std::max(p.x1, q.x1), std::max(p.y1, q.y1)};
+                boxes.erase(boxes.begin() + b);
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    for (auto& box : boxes) {
+        // one pixel of fixed labels around the box
+        Box window {
+            std::max(box.x0 - 1, 0), std::max(box.y0 - 1, 0),
+            std::min(box.x1 + 1, width), std::min(box.y1 + 1, height)
+        };
+        const int w = window.x1 - window.x0;
+        const int h = window.y1 - window.y0;
+        Matrix<unsigned char> gray(h, w, 1);
+        std::vector<int> crop_seeds(w * h), crop_labels(w * h);
+        std::vector<bool> crop_free(w * h);
+        for (int y = 0; y != h; ++y) {
+            for (int x = 0; x != w; ++x) {
+                int i = (window.y0 + y) * width + window.x0 + x;
+                int j = y * w + x;
+                gray.pt()[j] = gray_.pt()[i];
+                crop_seeds[j] = seeds[i] == unlabeled ? colors : seeds[i];
+                crop_labels[j] = labels_[i] == unlabeled ? colors : labels_[i];
+                crop_free[j] = box.x0 <= window.x0 + x and window.x0 + x < box.x1
+                    and box.y0 <= window.y0 + y and window.y0 + y < box.y1;
+            }
+        }
+
+        label_cuts(gray, crop_seeds, colors, crop_labels, crop_free);
+
+        for (int y = box.y0; y != box.y1; ++y) {
+            for (int x = box.x0; x != box.x1; ++x) {
+                int label = crop_labels[(y - window.y0) * w + x - window.x0];
+                labels_[y * width + x] = label == colors ? unlabeled : label;
+            }
+        }
+    }
+}
+
+// Superpixels grow from the lightest pixel of every cell of a grid by a
+// priority flood, light pixels first, so they meet on the strokes. Paper
+// the flood only reaches over a stroke starts a superpixel of its own. The
+// cut sequence of paint_with then runs on superpixels: neighbours share
+// the sum of the pixel edges between them, a superpixel gets
+// terminal_capacity_ per scribble pixel. Every pixel takes the label of
+// its superpixel. A superpixel can flow through a gap in a stroke the
+// pixel cut would close, so pixels within a cell of a label boundary and
+// regions holding scribbles of another color are cut again per pixel.
+void Painter::paint_superpixels(Matrix<unsigned char>& scribbles) {
+    assert(!scribbles.empty());
+    assert(scribbles.size() / 4 == gray_.size());
+
+    const int size = gray_.size();
+    const int width = gray_.width();
+    const int height = gray_.height();
+    const int cell = superpixel_size_;
+    auto* pt = gray_.pt();
+
+    std::vector<std::array<u_char, 3>> palette;
+    auto seeds = scribble_seeds(scribbles, palette);
+    const int colors = palette.size();
+
+    // bucket queue by darkness, a pixel never waits below the level of
+    // the pixel that reached it
+    const int paper = 128;
+    std::vector<int> superpixel(size, -1);
+    std::array<std::vector<int>, 256> buckets;
+    int n = 0;
+    for (int cy = 0; cy < height; cy += cell) {
+        for (int cx = 0; cx < width; cx += cell) {
+            int seed = cy * width + cx;
+            for (int y = cy; y != std::min(cy + cell, height); ++y)
+                for (int x = cx; x != std::min(cx + cell, width); ++x)
+                    if (pt[y * width + x] > pt[seed])
+                        seed = y * width + x;
+            superpixel[seed] = n++;
+            buckets[255 - pt[seed]].push_back(seed);
+        }
+    }
+    std::array<size_t, 256> head {};
+    for (int level = 0; level != 256;) {
+        if (head[level] == buckets[level].size()) {
+            buckets[level].clear();
+            head[level++] = 0;
+            continue;
+        }
+        const int p = buckets[level][head[level]++];
+        int next = level;
+        for_neighbours(p, width, size, [&](int q) {
+            if (superpixel[q] >= 0)
+                return;
+            // paper reached over a stroke has no seed of its own, it is
+            // flooded before the flood goes on
+            int q_level = 255 - pt[q];
+            bool crosses = 255 - pt[p] >= paper and q_level < paper;
+            superpixel[q] = crosses ? n++ : superpixel[p];
+            buckets[crosses ? q_level : std::max(level, q_level)].push_back(q);
+            if (crosses)
+                next = std::min(next, q_level);
+        });
+        level = next;
+    }
+
+    unsigned char zero_cancel = 1;
+    std::unordered_map<long long, int> boundary;
+    for (int i = 0; i != size; ++i) {
+        auto add = [&](int j) {
+            int a = superpixel[i], b = superpixel[j];
+            if (a == b)
+                return;
+            long long key = static_cast<long long>(std::min(a, b)) * n + std::max(a, b);
+            boundary[key] += std::max(zero_cancel, std::min(pt[i], pt[j]));
+        };
+        if ((i + 1) % width) add(i + 1);
+        if (i + width < size) add(i + width);
+    }
+    // scribble pixels per superpixel and color, the default color last
+    std::vector<int> counts(n * (colors + 1));
+    for (int i = 0; i != size; ++i)
+        if (seeds[i] >= 0)
+            ++counts[superpixel[i] * (colors + 1) + seeds[i]];
+
+    // same color order as paint_with, painted superpixels leave the graph
+    std::vector<int> labels(n, colors);
+    for (int color = 0; color != colors and !cancel_; ++color) {
+        BoykovKolmogorov<int> graph(n + 2);
+        for (auto [key, capacity] : boundary) {
+            int a = key / n, b = key % n;
+            if (labels[a] == colors and labels[b] == colors)
+                graph.add_bidirectional_edge(a, b, capacity);
+        }
+        for (int s = 0; s != n; ++s) {
+            if (labels[s] != colors)
+                continue;
+            // scribbles of all other colors are sinks
+            int own = 0, other = 0;
+            for (int c = 0; c <= colors; ++c)
+                (c == color ? own : other) += counts[s * (colors + 1) + c];
+            if (own)
+                graph.add_directional_edge(n, s, own * terminal_capacity_);
+            if (other)
+                graph.add_directional_edge(s, n + 1, other * terminal_capacity_);
+        }
+
+        if (async_)
+            graph.set_stop([this] { return bool(cancel_); });
+        graph.max_flow(n, n + 1);
+        if (graph.stopped())
+            break;
+        auto partition = graph.partition(n);
+        for (int s = 0; s != n; ++s)
+            if (partition[s] and labels[s] == colors)
+                labels[s] = color;
+    }
+
+    std::vector<int> pixel_labels(size);
+    for (int i = 0; i != size; ++i)
+        pixel_labels[i] = labels[superpixel[i]];
+    auto band = refine_band(seeds, pixel_labels, height, width, cell);
+    label_cuts(gray_, seeds, colors, pixel_labels, band);
+    set_labels(pixel_labels, palette);
+}
+
+void Painter::preview(Matrix<unsigned char>& input) {
+    assert(!input.empty());
+    assert(input.size() / 4 == gray_.size());
+    // the labels seeds_ describe stay the base of the next repaint
+    if (!seeds_.empty() and repaint_labels_.empty()) {
+        repaint_labels_.swap(labels_);
+        repaint_palette_.swap(palette_);
+        labels_.resize(gray_.size());
+    }
+    Matrix<unsigned char> merged;
+    auto& scribbles = merge_colors(input, merged);
+
+    std::vector<std::array<u_char, 3>> palette;
+    auto seeds = scribble_seeds(scribbles, palette);
+    const int colors = palette.size();
+
+    std::vector<int> labels(gray_.size());
+    geodesic_fill(seeds, 0, colors, labels, std::vector<bool>(labels.size(), true));
+
+    set_labels(labels, palette);
+    composite(drawing_painted_);
+}
+
+// Dial's algorithm, every scribble is a source at distance 0. Stepping
+// between pixels costs 256 - min(gray), 1 on paper and 255 across a
+// stroke, so colors stay behind strokes while there is paper to cover.
+void Painter::geodesic_fill(
+        const std::vector<int>& seeds,
+        int first_color,
+        int colors,
+        std::vector<int>& labels,
+        const std::vector<bool>& free)
+{
+    const int size = gray_.size();
+    const int width = gray_.width();
+    const int max_step = 256;
+    auto* pt = gray_.pt();
+
+    std::vector<int> distance(size, std::numeric_limits<int>::max());
+    // buckets of distances mod max_step + 1, none is ever further ahead
+    std::vector<std::vector<int>> buckets(max_step + 1);
+    int queued = 0;
+    for (int i = 0; i != size; ++i) {
+        if (!free[i])
+            continue;
+        labels[i] = colors;
+        if (seeds[i] < first_color)
+            continue;
+        distance[i] = 0;
+        labels[i] = seeds[i];
+        buckets[0].push_back(i);
+        ++queued;
+    }
+
+    for (int d = 0; queued; ++d) {
+        auto& bucket = buckets[d % buckets.size()];
+        for (size_t k = 0; k != bucket.size(); ++k) {
+            const int p = bucket[k];
+            --queued;
+            if (distance[p] != d)
+                continue;
+            for_neighbours(p, width, size, [&](int q) {
+                int next = d + max_step - std::min(pt[p], pt[q]);
+                if (!free[q] or next >= distance[q])
+                    return;
+                distance[q] = next;
+                labels[q] = labels[p];
+                buckets[next % buckets.size()].push_back(q);
+                ++queued;
+            });
+        }
+        bucket.clear();
+    }
+}
+
+// The exact cut sequence of paint_with runs on the grid solver until the
+// deadline, minus the time a geodesic fill took up front. A cut that
+// would overrun is stopped, its color and all later ones are filled
+// geodesically on the pixels no finished cut took.
+auto Painter::paint_within(
+        Matrix<unsigned char>& input,
+        std::chrono::milliseconds budget) -> std::vector<bool>
+{
+    assert(!input.empty());
+    assert(input.size() / 4 == gray_.size());
+
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+    clear_labels();
+    Matrix<unsigned char> merged;
+    auto& scribbles = merge_colors(input, merged);
+    const int pixels = gray_.size();
+
+    std::vector<std::array<u_char, 3>> palette;
+    auto seeds = scribble_seeds(scribbles, palette);
+    const int colors = palette.size();
+
+    // a complete answer first, its cost is what the fallback needs later
+    std::vector<int> labels(pixels);
+    std::vector<bool> free(pixels, true);
+    geodesic_fill(seeds, 0, colors, labels, free);
+    const auto deadline = start + budget - (clock::now() - start);
+
+    std::vector<bool> used_pixels(pixels);
+    int finished = 0;
+    for (; finished != colors and clock::now() < deadline; ++finished) {
+        auto& graph = reusable_graph<BoykovKolmogorov<int, GridGraph<int>>>();
+        if (!add_drawing_edges(graph, used_pixels)) {
+            finished = colors;
+            break;
+        }
+        auto& grid = graph.graph();
+        for (int i = 0; i != pixels; ++i) {
+            if (seeds[i] < 0)
+                continue;
+            if (seeds[i] == finished)
+                grid.add_source_capacity(i, terminal_capacity_);
+            else
+                grid.add_sink_capacity(i, terminal_capacity_);
+        }
+
+        graph.set_stop([&] { return clock::now() >= deadline; });
+        graph.max_flow(pixels, pixels + 1);
+        if (graph.stopped())
+            break;
         auto partition = graph.partition(pixels);
+        // like in paint_with, taken pixels with scribbles of this color
+        // are isolated sources and get repainted
+        for (int i = 0; i != pixels; ++i) {
+            if (partition[i]) {
+                labels[i] = finished;
+                used_pixels[i] = true;
+            }
+        }
+    }
 
-        blend_color(partition, new_color);
+    if (finished == colors) {
+        for (int i = 0; i != pixels; ++i)
+            if (!used_pixels[i])
+                labels[i] = colors;
+        used_pixels.assign(pixels, true);
+    }
+    else {
+        for (int i = 0; i != pixels; ++i)
+            free[i] = !used_pixels[i];
+        geodesic_fill(seeds, finished, colors, labels, free);
+    }
+
+    set_labels(labels, palette);
+    composite(drawing_painted_);
+    return used_pixels;
+}
+
+// Label 0 is the default color and leaves pixels unpainted, the other
+// labels are scribble colors. Scribbled pixels pay terminal_capacity_ for
+// any label but their own, neighbours with different labels pay the
+// drawing edge capacity. Moves run over all labels once, a second round
+// rarely changes anything on line art and costs another whole-image cut
+// per label.
+void Painter::paint_multi_label(Matrix<unsigned char>& scribbles) {
+    assert(!scribbles.empty());
+    assert(scribbles.channels() == 4);
+    assert(scribbles.size() / 4 == gray_.size());
+
+    const std::array<u_char, 3> default_color {255, 255, 255};
+    const int pixels = gray_.size();
+
+    std::vector<std::array<u_char, 3>> palette {default_color};
+    std::unordered_map<unsigned int, int> index {{color_to_int(default_color), 0}};
+    std::vector<int> seeds(pixels, -1);
+    auto* pt = scribbles.pt();
+    for (int i = 0; i != pixels; ++i) {
+        if (pt[4*i+3] == 0)
+            continue;
+        std::array<u_char, 3> color {pt[4*i], pt[4*i+1], pt[4*i+2]};
+        auto [it, added] = index.emplace(color_to_int(color), palette.size());
+        if (added)
+            palette.push_back(color);
+        seeds[i] = it->second;
+    }
+
+    // everything starts unpainted, so the first move is label 1 and the
+    // default color expands last, one move per label without checking
+    // whether another round would lower the energy
+    std::vector<int> labels(pixels, 0);
+    const int n_labels = palette.size();
+    for (int move = 1; move <= n_labels and !cancel_; ++move)
+        expand(move % n_labels, labels, seeds);
+
+    // without the default color labels move down by one
+    for (int& label : labels)
+        --label;
+    palette.erase(palette.begin());
+    set_labels(labels, palette);
+}
+
+// Source side takes alpha. Pixels already labeled alpha stay out of the
+// graph, their edges become terminal capacities of the neighbours.
+auto Painter::expand(
+        int alpha,
+        std::vector<int>& labels,
+        std::vector<int>& seeds) -> int
+{
+    const int size = gray_.size();
+    const int width = gray_.width();
+
+    auto& graph = reusable_graph<BoykovKolmogorov<int, GridGraph<int>>>();
+    auto& grid = graph.graph();
+
+    auto data = [&](int i, int label) {
+        return seeds[i] < 0 or seeds[i] == label ? 0 : terminal_capacity_;
+    };
+    unsigned char zero_cancel = 1;
+    auto* pt = gray_.pt();
+    auto add_pair = [&](int p, int q) {
+        int w = std::max(zero_cancel, std::min(pt[p], pt[q]));
+        if (labels[p] == alpha and labels[q] == alpha)
+            return;
+        if (labels[p] == alpha)
+            return grid.add_source_capacity(q, w);
+        if (labels[q] == alpha)
+            return grid.add_source_capacity(p, w);
+        if (labels[p] == labels[q])
+            return grid.add_bidirectional_edge(p, q, w);
+        // E(keep, keep) = E(keep, alpha) = E(alpha, keep) = w
+        grid.add_source_capacity(q, w);
+        grid.add_directional_edge(q, p, w);
+    };
+
+    for (int i = 0; i != size; ++i) {
+        if (i % width)
+            add_pair(i - 1, i);
+        if (i >= width)
+            add_pair(i - width, i);
+        if (labels[i] == alpha)
+            continue;
+        grid.add_source_capacity(i, data(i, labels[i]));
+        grid.add_sink_capacity(i, data(i, alpha));
+    }
+
+    if (async_)
+        graph.set_stop([this] { return bool(cancel_); });
+    graph.max_flow(size, size + 1);
+    // a cancelled paint keeps the labels it has
+    if (graph.stopped())
+        return 0;
+    auto partition = graph.partition(size);
+
+    int changed = 0;
+    for (int i = 0; i != size; ++i) {
+        if (partition[i] and labels[i] != alpha) {
+            labels[i] = alpha;
+            ++changed;
+        }
+    }
+    return changed;
+}
+
+// same color order and pixels as paint_with, but graphs of colors that
+// keep their place are updated with the differences and re-solved
+void Painter::paint_incremental(Matrix<unsigned char>& scribbles) {
+    const int pixels = gray_.size();
+    std::vector<bool> used_pixels(pixels);
+    auto index = index_scribbles(scribbles);
+    palette_ = index.palette;
+    std::vector<signed char> terminals(pixels);
+    for (int i : index.pixels)
+        terminals[i] = -1;
+
+    int layer = 0;
+    for (; layer != static_cast<int>(index.palette.size()); ++layer) {
+        const auto new_color = index.palette[layer];
+        if (!has_drawing_edges(used_pixels)) {
+            break;
+        }
+        mark_terminals(index, layer, terminals);
+
+        Layer scratch;
+        if (layer < static_cast<int>(layers_.size()) and layers_[layer].color == new_color) {
+            update_layer(layers_[layer], terminals, used_pixels);
+        }
+        else if (layer < max_layers) {
+            // color order changed, later graphs can't be reused
+            layers_.resize(layer);
+            layers_.push_back(make_layer(new_color, terminals, used_pixels));
+        }
+        else {
+            scratch = make_layer(new_color, terminals, used_pixels);
+        }
+
+        auto& graph = layer < max_layers ? *layers_[layer].graph : *scratch.graph;
+        graph.set_stop(async_ ? std::function<bool()>([this] { return bool(cancel_); }) : nullptr);
+        graph.max_flow(pixels, pixels + 1);
+        // a stopped layer is dropped below
+        if (graph.stopped())
+            break;
+        auto partition = graph.partition(pixels);
 
-        // unite new and old used pixels
-        // Warning: vector<bool> may cause valgrind errors
-        /*
-        std::transform( 
-                partition.begin(), partition.end(),
-                used_pixels.begin(), used_pixels.begin(),
-                [](bool a, bool b) { return a || b; }
-        ); */
         for (int i = 0; i != pixels; ++i) {
-            used_pixels[i] = used_pixels[i] || partition[i];
+            if (partition[i]) {
+                labels_[i] = layer;
+                used_pixels[i] = true;
+            }
         }
+        if (!color_done(layer + 1, index.palette.size())) {
+            ++layer;
+            break;
+        }
+    }
+    layers_.resize(std::min(layer, max_layers));
+}
+
+auto Painter::make_layer(
+        std::array<u_char, 3> color,
+        std::vector<signed char>& terminals,
+        std::vector<bool>& used_pixels) -> Layer
+{
+    Layer layer {color, std::make_unique<DynamicGraph>(gray_.height(), gray_.width()), terminals, used_pixels};
+    add_drawing_edges(*layer.graph, used_pixels);
+
+    auto& grid = layer.graph->graph();
+    for (size_t i = 0; i != terminals.size(); ++i) {
+        if (terminals[i] > 0)
+            grid.add_source_capacity(i, terminal_capacity_);
+        else if (terminals[i] < 0)
+            grid.add_sink_capacity(i, terminal_capacity_);
     }
+    return layer;
 }
 
+void Painter::update_layer(
+        Layer& layer,
+        std::vector<signed char>& terminals,
+        std::vector<bool>& used_pixels)
+{
+    const int size = gray_.size();
+    const int width = gray_.width();
+    auto& graph = *layer.graph;
+    auto& old_used = layer.used_pixels;
+
+    for (int i = 0; i != size; ++i) {
+        if (terminals[i] == layer.terminals[i])
+            continue;
+        int source_delta = (terminals[i] > 0) - (layer.terminals[i] > 0);
+        int sink_delta = (terminals[i] < 0) - (layer.terminals[i] < 0);
+        graph.add_terminal_capacity(
+                i,
+                source_delta * terminal_capacity_,
+                sink_delta * terminal_capacity_);
+    }
+
+    // an edge exists while both of its pixels are unused
+    unsigned char zero_cancel = 1;
+    auto* pt = gray_.pt();
+    auto update_edge = [&](int u, int v, GridGraph<int>::Direction dir) {
+        bool had = !old_used[u] and !old_used[v];
+        bool has = !used_pixels[u] and !used_pixels[v];
+        if (had == has)
+            return;
+        int cap = std::max(zero_cancel, std::min(pt[u], pt[v]));
+        if (had)
+            cap = -cap;
+        graph.add_edge_capacity(GridGraph<int>::arc(u, dir), cap, cap);
+    };
+    for (int i = 0; i != size; ++i) {
+        if (used_pixels[i] == old_used[i])
+            continue;
+        // edges to changed left and upper pixels were handled from there
+        if (i % width and used_pixels[i-1] == old_used[i-1])
+            update_edge(i-1, i, GridGraph<int>::RIGHT);
+        if ((i + 1) % width)
+            update_edge(i, i+1, GridGraph<int>::RIGHT);
+        if (i >= width and used_pixels[i-width] == old_used[i-width])
+            update_edge(i-width, i, GridGraph<int>::DOWN);
+        if (i + width < size)
+            update_edge(i, i+width, GridGraph<int>::DOWN);
+    }
+
+    layer.terminals = terminals;
+    layer.used_pixels = used_pixels;
+}
+
+// Every pixel owns the edges to its left and upper neighbours. Arcs of a
+// pixel are laid out as left, up, right, down, terminal, so slots of both
+// ends are known without coordination and stripes are filled in parallel.
+template <class graph_t>
+void Painter::build_graph(
+        graph_t& graph,
+        std::vector<bool>& used_pixels,
+        std::vector<signed char>& terminals)
+{
+    assert(static_cast<int>(gray_.size()) + 2 == graph.V());
+
+    const int size = gray_.size();
+    const int width = gray_.width();
+    const int source = size;
+    const int sink = size + 1;
+    auto& threads = pool();
+
+    auto left = [&](int i) -> int { 
+        return i % width and !used_pixels[i] and !used_pixels[i-1]; 
+    };
+    auto up = [&](int i) -> int { 
+        return i >= width and !used_pixels[i] and !used_pixels[i-width]; 
+    };
+    auto right = [&](int i) -> int { return (i + 1) % width and left(i + 1); };
+    auto down = [&](int i) -> int { return i + width < size and up(i + width); };
+
+    // terminal arcs per stripe, for the slots at source and sink
+    std::vector<int> sources(threads.size() + 1), sinks(threads.size() + 1);
+    threads.parallel_for(gray_.height(), [&](int begin, int end, int t) {
+        for (int i = begin * width; i != end * width; ++i) {
+            graph.reserve_edges(node(i), left(i) + up(i) + right(i) + down(i) + (terminals[i] != 0));
+            sources[t + 1] += terminals[i] > 0;
+            sinks[t + 1] += terminals[i] < 0;
+        }
+    });
+    for (int t = 0; t != threads.size(); ++t) {
+        sources[t + 1] += sources[t];
+        sinks[t + 1] += sinks[t];
+    }
+    graph.reserve_edges(source, sources.back());
+    graph.reserve_edges(sink, sinks.back());
+    graph.freeze();
+
+    unsigned char zero_cancel = 1;
+    auto* pt = gray_.pt();
+    threads.parallel_for(gray_.height(), [&](int begin, int end, int t) {
+        int source_slot = sources[t];
+        int sink_slot = sinks[t];
+        for (int i = begin * width; i != end * width; ++i) {
+            const int l = left(i), u = up(i);
+            if (l) {
+                unsigned char new_val = std::min(pt[i], pt[i-1]);
+                graph.set_bidirectional_edge(
+                        node(i), 0, node(i-1), left(i-1) + up(i-1), 
+                        std::max(zero_cancel, new_val));
+            }
+            if (u) {
+                unsigned char new_val = std::min(pt[i], pt[i-width]);
+                const int p = i - width;
+                graph.set_bidirectional_edge(
+                        node(i), l, node(p), left(p) + up(p) + right(p), 
+                        std::max(zero_cancel, new_val));
+            }
+            const int terminal_slot = l + u + right(i) + down(i);
+            if (terminals[i] > 0)
+                graph.set_directional_edge(source, source_slot++, node(i), terminal_slot, terminal_capacity_);
+            else if (terminals[i] < 0)
+                graph.set_directional_edge(node(i), terminal_slot, sink, sink_slot++, terminal_capacity_);
+        }
+    });
+}
+
+auto Painter::pool() -> ThreadPool& {
+    if (!pool_ or (threads_ > 0 and pool_->size() != threads_))
+        pool_ = std::make_unique<ThreadPool>(threads_);
+    return *pool_;
+}
+
+bool Painter::has_drawing_edges(std::vector<bool>& used_pixels) {
+    const int size = gray_.size();
+    const int width = gray_.width();
+    for (int i = 0; i != size; ++i) {
+        if (used_pixels[i])
+            continue;
+        if (i % width and !used_pixels[i-1])
+            return true;
+        if (i >= width and !used_pixels[i-width])
+            return true;
+    }
+    return false;
+}
+
+template <class graph_t>
 bool Painter::add_drawing_edges(
-        Dinic<int>& graph, 
+        graph_t& graph, 
         std::vector<bool>& used_pixels)
 {
     assert(!gray_.empty());
     assert(gray_.channels() == 1);
     assert(used_pixels.size() == gray_.size());
-    assert(gray_.size() + 2 == graph.V());
+    assert(static_cast<int>(gray_.size()) + 2 == graph.V());
     
-    const auto size = gray_.size();
-    const auto width = gray_.width();
+    const int size = gray_.size();
+    const int width = gray_.width();
 
     unsigned char zero_cancel = 1;
     auto* pt = gray_.pt();
@@ -122,69 +2002,137 @@ bool Painter::add_drawing_edges(
         if (i % width and !used_pixels[i-1]) {
             new_edge_added = true;
             unsigned char new_val = std::min(pt[i], pt[i-1]);
-            graph.add_bidirectional_edge(
-                    i, i-1, 
-                    std::max(zero_cancel, new_val));
+            if constexpr (runs_on_grid_v<graph_t>)
+                graph.graph().set_horizontal(i-1, std::max(zero_cancel, new_val));
+            else
+                graph.add_bidirectional_edge(
+                        node(i), node(i-1), 
+                        std::max(zero_cancel, new_val));
         }
         if (i >= width and !used_pixels[i-width]) {
             new_edge_added = true;
             unsigned char new_val = std::min(pt[i], pt[i-width]);
-            graph.add_bidirectional_edge(
-                    i, i-width, 
-                    std::max(zero_cancel, new_val));
+            if constexpr (runs_on_grid_v<graph_t>)
+                graph.graph().set_vertical(i-width, std::max(zero_cancel, new_val));
+            else
+                graph.add_bidirectional_edge(
+                        node(i), node(i-width), 
+                        std::max(zero_cancel, new_val));
         }        
     }
 
     return new_edge_added;
 }
 
-bool Painter::add_scribbles_edges(
-        Dinic<int>& graph,
-        std::unordered_set<unsigned int>& used_colors,
-        std::array<u_char, 3>& new_color,
-        Matrix<unsigned char>& scribbles) 
+template <class graph_t>
+void Painter::add_scribbles_edges(
+        graph_t& graph,
+        const ScribbleIndex& index,
+        const std::vector<signed char>& terminals)
 {
-    assert(!scribbles.empty());
-    assert(scribbles.channels() == 4);
-    assert(scribbles.size()/scribbles.channels() + 2 == graph.V());
+    assert(static_cast<int>(terminals.size()) + 2 == graph.V());
 
     int source = graph.V()-2;
     int sink = source + 1;
 
-    const auto size = scribbles.size();
-    auto* pt = scribbles.pt();
+    for (int i : index.pixels) {
+        if (terminals[i] > 0)
+            graph.add_directional_edge(source, node(i), terminal_capacity_);
+        else
+            graph.add_directional_edge(node(i), sink, terminal_capacity_);
+    }
+}
 
-    int id = 0;
-    for (; id < size; id += 4) {
-        if (pt[id+3] == 0) 
-            continue; 
-        auto color = color_to_int({pt[id+0], pt[id+1], pt[id+2]});
-        if (used_colors.find(color) != used_colors.end()) {
-            graph.add_directional_edge(id / 4, sink, terminal_capacity_);
-            continue;
-        }
+void Painter::mark_terminals(
+        const ScribbleIndex& index,
+        int color,
+        std::vector<signed char>& terminals)
+{
+    assert(0 <= color and color < static_cast<int>(index.palette.size()));
 
-        new_color = {pt[id+0], pt[id+1], pt[id+2]};
-        break;
-    }
+    if (color > 0)
+        for (int k = index.offset[color - 1]; k != index.offset[color]; ++k)
+            terminals[index.pixels[k]] = -1;
+    for (int k = index.offset[color]; k != index.offset[color + 1]; ++k)
+        terminals[index.pixels[k]] = 1;
+}
+
+template void Painter::paint_with<Dinic<int>>(Matrix<unsigned char>&);
+template void Painter::paint_with<Dinic<int, std::uint16_t>>(Matrix<unsigned char>&);
+template void Painter::paint_with<EdmondsKarp<int>>(Matrix<unsigned char>&);
+template void Painter::paint_with<BoykovKolmogorov<int>>(Matrix<unsigned char>&);
+template void Painter::paint_with<BoykovKolmogorov<int, GridGraph<int>>>(Matrix<unsigned char>&);
+template void Painter::paint_with<PushRelabel<int, GridGraph<int>>>(Matrix<unsigned char>&);
+
+// Labels of the last frame are a good cut wherever the line art stayed,
+// so they are kept there. Pixels whose gray level moved by more than
+// frame_tolerance, or whose scribble disagrees with their label, grow by
+// frame_margin and are re-solved with label_cuts, the kept labels around
+// them act as sources and sinks. A frame that mostly changed, or has
+// another size, is painted from scratch.
+auto Painter::paint_next_frame(
+        const char* filename,
+        Matrix<unsigned char>& input) -> bool
+{
+    const int frame_tolerance = 24;
+    const int frame_margin = 8;
 
-    // all colors are alread in used_colors 
-    if (id >= size) {
+    auto previous_gray = gray_.copy();
+    auto labels = labels_;
+    auto palette = palette_;
+    if (!imread(filename))
         return false;
+    // the kept flows and repaint seeds are of the old drawing, even if
+    // the scribbles turn out not to fit the new one
+    layers_.clear();
+    seeds_.clear();
+    repaint_labels_.clear();
+    repaint_palette_.clear();
+    init_gray(1/2.0);
+    // scribbles of another size would be read at the wrong stride
+    if (input.size() / 4 != gray_.size())
+        return false;
+
+    Matrix<unsigned char> merged;
+    auto& scribbles = merge_colors(input, merged);
+    const int size = gray_.size();
+    if (!(previous_gray.shape() == gray_.shape())) {
+        paint_labels(scribbles);
+        composite(drawing_painted_);
+        return true;
     }
+    labels_.swap(labels);
+    palette_.swap(palette);
 
-    for (int i = id; i < size; i += 4) {
-        if (pt[i+3] == 0) 
-            continue; 
-        
-        if (pt[i] == new_color[0] and pt[i+1] == new_color[1] and pt[i+2] == new_color[2]) {
-            graph.add_directional_edge(source, i / 4, terminal_capacity_);
-        }
-        else {
-            graph.add_directional_edge(i / 4, sink, terminal_capacity_);
-        }
+    auto seeds = palette_seeds(scribbles);
+    const int colors = palette_.size();
+    std::vector<bool> free(size);
+    auto* pt = gray_.pt();
+    auto* prev_pt = previous_gray.pt();
+    for (int i = 0; i != size; ++i) {
+        free[i] = std::abs(pt[i] - prev_pt[i]) > frame_tolerance
+            or (seeds[i] >= 0 and seeds[i] != labels_[i]);
     }
+    dilate(free, gray_.height(), gray_.width(), frame_margin);
+    const int changed = std::count(free.begin(), free.end(), true);
 
+    if (changed > size / 2 or colors >= unlabeled) {
+        clear_labels();
+        paint_labels(scribbles);
+    }
+    else if (changed > 0) {
+        std::vector<int> cut_labels(size);
+        for (int i = 0; i != size; ++i) {
+            cut_labels[i] = labels_[i] == unlabeled ? colors : labels_[i];
+            if (seeds[i] == unlabeled)
+                seeds[i] = colors;
+        }
+        label_cuts(gray_, seeds, colors, cut_labels, free);
+        for (int i = 0; i != size; ++i)
+            if (free[i])
+                labels_[i] = cut_labels[i] == colors ? unlabeled : cut_labels[i];
+    }
+    composite(drawing_painted_);
     return true;
 }
 
@@ -207,18 +2155,10 @@ auto Painter::imread(const char* filename) -> bool {
 
     drawing_painted_.reset(h, w, 4);
     drawing_.reset(h, w, c);
-    int size = drawing_.size();
-    auto *o_pt = drawing_.pt();
-    auto *p_pt = drawing_painted_.pt();
-    int o_id = 0, p_id = 0;
-
-    // data should have 3 channels
-    for (int i = 0; i < size; i += 3) {
-        p_pt[p_id++] = o_pt[o_id++] = data[i]; 
-        p_pt[p_id++] = o_pt[o_id++] = data[i+1]; 
-        p_pt[p_id++] = o_pt[o_id++] = data[i+2]; 
-        p_pt[p_id++] = 255;
-    }
+    labels_.assign(h * w, unlabeled);
+    palette_.clear();
+    std::copy(data, data + drawing_.size(), drawing_.pt());
+    rgb_to_rgba(data, drawing_painted_.pt(), h * w);
 
     stbi_image_free(data);
     return true;
@@ -277,13 +2217,5 @@ void Painter::init_gray(float gamma) {
 
     gray_.reset(drawing_.height(), drawing_.width(), 1);
 
-    auto p_orig = drawing_.pt();
-    auto p_gray = gray_.pt();
-    auto size = drawing_.size();
-    for (int i = 0, j = 0; i < size; ++j, i += 3) {
-        auto gray_value = (p_orig[i]*0.2126 + p_orig[i+1]*0.7152 + p_orig[i+2]*0.0722 + 0.3) / 255.0;
-        auto gray_value_corrected = std::pow(gray_value, 1/gamma);
-        auto gray_value_scaled = static_cast<unsigned char>(gray_value_corrected * 255.0);
-        p_gray[j] = gray_value_scaled;
-    }
+    rgb_to_gray(drawing_.pt(), gray_.pt(), gray_.size(), gamma_table(gamma));
 }
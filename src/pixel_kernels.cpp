@@ -0,0 +1,257 @@
+#include "pixel_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__))
+#define PIXEL_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr GammaTable square_table(square_curve);
+
+auto detect_simd_level() -> SimdLevel {
+#ifdef PIXEL_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("ssse3"))
+        return SimdLevel::SSSE3;
+#endif
+    return SimdLevel::SCALAR;
+}
+
+const SimdLevel supported_level = detect_simd_level();
+SimdLevel level = supported_level;
+
+// same operations in the same order as the pow version
+inline auto gray_of(const std::uint8_t* p, const GammaTable& table) -> std::uint8_t {
+    double l = p[0]*0.2126 + p[1]*0.7152 + p[2]*0.0722 + 0.3;
+    int v = table.low[static_cast<int>(l * GammaTable::buckets_per_level)];
+    for (int s = 0; s != table.max_steps; ++s)
+        v += l >= table.threshold[v + 1];
+    return v;
+}
+
+void rgb_to_gray_scalar(
+        const std::uint8_t* rgb, std::uint8_t* gray, int begin, int end, const GammaTable& table) {
+    for (int i = begin; i < end; ++i)
+        gray[i] = gray_of(rgb + 3*i, table);
+}
+
+void rgb_to_rgba_scalar(const std::uint8_t* rgb, std::uint8_t* rgba, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+        rgba[4*i] = rgb[3*i];
+        rgba[4*i+1] = rgb[3*i+1];
+        rgba[4*i+2] = rgb[3*i+2];
+        rgba[4*i+3] = 255;
+    }
+}
+
+void composite_scalar(
+        const std::uint8_t* rgb,
+        const std::uint16_t* labels,
+        int colors,
+        const float* factor,
+        std::uint8_t* rgba,
+        int begin,
+        int end) {
+    for (int i = begin; i < end; ++i) {
+        const float* f = factor + 3 * std::min<int>(labels[i], colors);
+        rgba[4*i] = rgb[3*i] * f[0];
+        rgba[4*i+1] = rgb[3*i+1] * f[1];
+        rgba[4*i+2] = rgb[3*i+2] * f[2];
+        rgba[4*i+3] = 255;
+    }
+}
+
+#ifdef PIXEL_KERNELS_X86
+// 4 pixels of 3 bytes spread over 4 dwords, the 4th byte zeroed
+__attribute__((target("ssse3")))
+inline auto spread_rgb() -> __m128i {
+    return _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+}
+
+// loads read 16 bytes and use 12, the loops leave the last pixels to
+// the scalar tails so they never read past the image
+__attribute__((target("ssse3")))
+auto rgb_to_rgba_ssse3(const std::uint8_t* rgb, std::uint8_t* rgba, int pixels) -> int {
+    const __m128i spread = spread_rgb();
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000u));
+    int i = 0;
+    for (; i + 6 <= pixels; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + 3*i));
+        v = _mm_or_si128(_mm_shuffle_epi8(v, spread), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + 4*i), v);
+    }
+    return i;
+}
+
+// 8 pixels of 3 bytes spread over 8 dwords
+__attribute__((target("avx2")))
+inline auto load_rgb8(const std::uint8_t* p) -> __m256i {
+    __m256i v = _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    v = _mm256_inserti128_si256(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12)), 1);
+    return _mm256_shuffle_epi8(v, _mm256_broadcastsi128_si256(spread_rgb()));
+}
+
+__attribute__((target("avx2")))
+auto rgb_to_rgba_avx2(const std::uint8_t* rgb, std::uint8_t* rgba, int pixels) -> int {
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+    int i = 0;
+    for (; i + 10 <= pixels; i += 8) {
+        __m256i v = _mm256_or_si256(load_rgb8(rgb + 3*i), alpha);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + 4*i), v);
+    }
+    return i;
+}
+
+// luma of 4 spread pixels, without fma that rounds differently from
+// the scalar version
+__attribute__((target("avx2")))
+inline auto luma4(__m128i v) -> __m256d {
+    const __m128i byte = _mm_set1_epi32(0xff);
+    __m256d r = _mm256_cvtepi32_pd(_mm_and_si128(v, byte));
+    __m256d g = _mm256_cvtepi32_pd(_mm_and_si128(_mm_srli_epi32(v, 8), byte));
+    __m256d b = _mm256_cvtepi32_pd(_mm_srli_epi32(v, 16));
+    __m256d l = _mm256_mul_pd(r, _mm256_set1_pd(0.2126));
+    l = _mm256_add_pd(l, _mm256_mul_pd(g, _mm256_set1_pd(0.7152)));
+    l = _mm256_add_pd(l, _mm256_mul_pd(b, _mm256_set1_pd(0.0722)));
+    return _mm256_add_pd(l, _mm256_set1_pd(0.3));
+}
+
+__attribute__((target("avx2")))
+inline auto bucket4(__m256d l) -> __m128i {
+    return _mm256_cvttpd_epi32(_mm256_mul_pd(l, _mm256_set1_pd(GammaTable::buckets_per_level)));
+}
+
+// one threshold step of 4 gray values
+__attribute__((target("avx2")))
+inline auto step4(__m256d l, __m128i value, const GammaTable& table) -> __m128i {
+    __m256d all = _mm256_castsi256_pd(_mm256_set1_epi32(-1));
+    __m128i next = _mm_add_epi32(value, _mm_set1_epi32(1));
+    __m256d t = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), table.threshold.data(), next, all, 8);
+    __m256d ge = _mm256_and_pd(_mm256_cmp_pd(l, t, _CMP_GE_OQ), _mm256_set1_pd(1.0));
+    return _mm_add_epi32(value, _mm256_cvttpd_epi32(ge));
+}
+
+__attribute__((target("avx2")))
+auto rgb_to_gray_avx2(
+        const std::uint8_t* rgb, std::uint8_t* gray, int pixels, const GammaTable& table) -> int {
+    int i = 0;
+    for (; i + 10 <= pixels; i += 8) {
+        __m256i v = load_rgb8(rgb + 3*i);
+        __m256d lo = luma4(_mm256_castsi256_si128(v));
+        __m256d hi = luma4(_mm256_extracti128_si256(v, 1));
+        __m256i k = _mm256_set_m128i(bucket4(hi), bucket4(lo));
+        __m256i value = _mm256_i32gather_epi32(table.low.data(), k, 4);
+        __m128i value_lo = _mm256_castsi256_si128(value);
+        __m128i value_hi = _mm256_extracti128_si256(value, 1);
+        for (int s = 0; s != table.max_steps; ++s) {
+            value_lo = step4(lo, value_lo, table);
+            value_hi = step4(hi, value_hi, table);
+        }
+        __m128i packed = _mm_packus_epi16(_mm_packus_epi32(value_lo, value_hi), value_lo);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(gray + i), packed);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+auto composite_avx2(
+        const std::uint8_t* rgb,
+        const std::uint16_t* labels,
+        int colors,
+        const float* factor,
+        std::uint8_t* rgba,
+        int pixels) -> int {
+    const __m256i last = _mm256_set1_epi32(colors);
+    const __m256i byte = _mm256_set1_epi32(0xff);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+    int i = 0;
+    for (; i + 10 <= pixels; i += 8) {
+        __m256i v = load_rgb8(rgb + 3*i);
+        __m256i l = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(labels + i)));
+        l = _mm256_min_epu32(l, last);
+        l = _mm256_add_epi32(l, _mm256_add_epi32(l, l));
+
+        __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(v, byte));
+        __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), byte));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_srli_epi32(v, 16));
+        r = _mm256_mul_ps(r, _mm256_i32gather_ps(factor, l, 4));
+        g = _mm256_mul_ps(g, _mm256_i32gather_ps(factor + 1, l, 4));
+        b = _mm256_mul_ps(b, _mm256_i32gather_ps(factor + 2, l, 4));
+
+        __m256i out = _mm256_or_si256(_mm256_cvttps_epi32(r), alpha);
+        out = _mm256_or_si256(out, _mm256_slli_epi32(_mm256_cvttps_epi32(g), 8));
+        out = _mm256_or_si256(out, _mm256_slli_epi32(_mm256_cvttps_epi32(b), 16));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + 4*i), out);
+    }
+    return i;
+}
+#endif
+
+}
+
+auto supported_simd_level() -> SimdLevel {
+    return supported_level;
+}
+
+auto simd_level() -> SimdLevel {
+    return level;
+}
+
+void set_simd_level(SimdLevel simd) {
+    level = std::min(simd, supported_level);
+}
+
+auto gamma_table(float gamma) -> GammaTable {
+    if (1/gamma == 2)
+        return square_table;
+    const double exponent = 1/gamma;
+    return GammaTable([exponent](double x) {
+        return static_cast<int>(std::pow(x, exponent) * 255.0);
+    });
+}
+
+void rgb_to_gray(
+        const std::uint8_t* rgb,
+        std::uint8_t* gray,
+        int pixels,
+        const GammaTable& table) {
+    int done = 0;
+#ifdef PIXEL_KERNELS_X86
+    if (level == SimdLevel::AVX2)
+        done = rgb_to_gray_avx2(rgb, gray, pixels, table);
+#endif
+    rgb_to_gray_scalar(rgb, gray, done, pixels, table);
+}
+
+void rgb_to_rgba(const std::uint8_t* rgb, std::uint8_t* rgba, int pixels) {
+    int done = 0;
+#ifdef PIXEL_KERNELS_X86
+    if (level == SimdLevel::AVX2)
+        done = rgb_to_rgba_avx2(rgb, rgba, pixels);
+    else if (level == SimdLevel::SSSE3)
+        done = rgb_to_rgba_ssse3(rgb, rgba, pixels);
+#endif
+    rgb_to_rgba_scalar(rgb, rgba, done, pixels);
+}
+
+void composite_labels(
+        const std::uint8_t* rgb,
+        const std::uint16_t* labels,
+        int colors,
+        const float* factor,
+        std::uint8_t* rgba,
+        int pixels) {
+    int done = 0;
+#ifdef PIXEL_KERNELS_X86
+    if (level == SimdLevel::AVX2)
+        done = composite_avx2(rgb, labels, colors, factor, rgba, pixels);
+#endif
+    composite_scalar(rgb, labels, colors, factor, rgba, done, pixels);
+}
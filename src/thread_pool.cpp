@@ -0,0 +1,56 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(int threads)
+    : threads_ {threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency())}
+{
+    threads_ = std::max(threads_, 1);
+    for (int id = 1; id < threads_; ++id)
+        workers_.emplace_back(&ThreadPool::worker, this, id);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& w : workers_)
+        w.join();
+}
+
+void ThreadPool::run(const std::function<void(int)>& job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = &job;
+        pending_ = threads_ - 1;
+        ++generation_;
+    }
+    start_.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+    job_ = nullptr;
+}
+
+void ThreadPool::worker(int id) {
+    unsigned seen = 0;
+    while (true) {
+        const std::function<void(int)>* job {};
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&] { return stop_ or generation_ != seen; });
+            if (stop_)
+                return;
+            seen = generation_;
+            job = job_;
+        }
+
+        (*job)(id);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending_ == 0)
+            done_.notify_one();
+    }
+}
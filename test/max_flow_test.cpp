@@ -0,0 +1,379 @@
+#include <gtest/gtest.h>
+
+#include <dinic.hpp>
+#include <edmonds_karp.hpp>
+#include <boykov_kolmogorov.hpp>
+#include <grid_graph.hpp>
+#include <push_relabel.hpp>
+
+#include <cstdint>
+#include <random>
+#include <tuple>
+#include <vector>
+
+class MaxFlowTest : public ::testing::Test {
+protected:
+    // <u, v, capacity, bidirectional>
+    using EdgeList = std::vector<std::tuple<int, int, int, bool>>;
+
+    static auto random_graph(int V, int E, unsigned seed) -> EdgeList {
+        std::mt19937 gen(seed);
+        std::uniform_int_distribution<int> node(0, V - 1);
+        std::uniform_int_distribution<int> cap(0, 20);
+        EdgeList edges;
+        for (int i = 0; i != E; ++i) {
+            int u = node(gen), v = node(gen);
+            if (u == v)
+                continue;
+            edges.emplace_back(u, v, cap(gen), gen() % 2);
+        }
+        return edges;
+    }
+
+    // 4-connected grid with terminals at V-2 and V-1, like Painter builds
+    static auto grid_graph(int height, int width, unsigned seed) -> EdgeList {
+        std::mt19937 gen(seed);
+        std::uniform_int_distribution<int> cap(1, 255);
+        const int pixels = height * width;
+        EdgeList edges;
+        for (int i = 0; i != pixels; ++i) {
+            if (i % width)
+                edges.emplace_back(i, i - 1, cap(gen), true);
+            if (i >= width)
+                edges.emplace_back(i, i - width, cap(gen), true);
+            if (gen() % 7 == 0)
+                edges.emplace_back(pixels, i, 23, false);
+            else if (gen() % 7 == 0)
+                edges.emplace_back(i, pixels + 1, 23, false);
+        }
+        return edges;
+    }
+
+    template <class graph_t>
+    static void fill(graph_t& graph, const EdgeList& edges) {
+        for (auto [u, v, c, bidirectional] : edges) {
+            if (bidirectional)
+                graph.add_bidirectional_edge(u, v, c);
+            else
+                graph.add_directional_edge(u, v, c);
+        }
+    }
+
+    template <class graph_t>
+    static void expect_same_as_dinic(int V, const EdgeList& edges, int source, int sink) {
+        Dinic<int> reference(V);
+        fill(reference, edges);
+        graph_t graph(V);
+        fill(graph, edges);
+
+        EXPECT_EQ(graph.max_flow(source, sink), reference.max_flow(source, sink));
+        EXPECT_EQ(graph.partition(source), reference.partition(source));
+    }
+};
+
+TEST_F(MaxFlowTest, BoykovKolmogorovSimple) {
+    BoykovKolmogorov<int> graph(4);
+    graph.add_directional_edge(0, 1, 3);
+    graph.add_directional_edge(0, 2, 2);
+    graph.add_directional_edge(1, 2, 5);
+    graph.add_directional_edge(1, 3, 2);
+    graph.add_directional_edge(2, 3, 3);
+
+    EXPECT_EQ(graph.max_flow(0, 3), 5);
+    EXPECT_EQ(graph.partition(0), (std::vector<bool>{true, false, false, false}));
+    EXPECT_EQ(graph.min_cut(0).size(), 2);
+}
+
+TEST_F(MaxFlowTest, BoykovKolmogorovRandomGraphs) {
+    for (unsigned seed = 0; seed != 50; ++seed) {
+        auto edges = random_graph(30, 120, seed);
+        expect_same_as_dinic<BoykovKolmogorov<int>>(30, edges, 0, 29);
+    }
+}
+
+TEST_F(MaxFlowTest, BoykovKolmogorovGrid) {
+    for (unsigned seed = 0; seed != 5; ++seed) {
+        auto edges = grid_graph(40, 60, seed);
+        expect_same_as_dinic<BoykovKolmogorov<int>>(40 * 60 + 2, edges, 40 * 60, 40 * 60 + 1);
+    }
+}
+
+TEST_F(MaxFlowTest, DinicLongPath) {
+    // one augmenting path through every node, too deep for recursion
+    const int V = 2'000'000;
+    Dinic<int> graph(V);
+    for (int i = 0; i + 1 != V; ++i)
+        graph.add_directional_edge(i, i + 1, 2 + i % 3);
+
+    EXPECT_EQ(graph.max_flow(0, V - 1), 2);
+    EXPECT_EQ(graph.min_cut(0).size(), 1);
+}
+
+TEST_F(MaxFlowTest, DinicParallelBfs) {
+    // frontiers big enough for the parallel and bottom-up steps
+    for (unsigned seed = 0; seed != 3; ++seed) {
+        auto edges = random_graph(20'000, 100'000, seed);
+        Dinic<int> reference(20'000);
+        fill(reference, edges);
+        Dinic<int> graph(20'000);
+        graph.set_threads(4);
+        fill(graph, edges);
+
+        EXPECT_EQ(graph.max_flow(0, 19'999), reference.max_flow(0, 19'999));
+        EXPECT_EQ(graph.partition(0), reference.partition(0));
+    }
+}
+
+TEST_F(MaxFlowTest, DinicTwoPhaseBuilder) {
+    const int height = 40, width = 60, pixels = height * width;
+    for (unsigned seed = 0; seed != 5; ++seed) {
+        auto edges = grid_graph(height, width, seed);
+        Dinic<int> reference(pixels + 2);
+        fill(reference, edges);
+
+        Dinic<int, std::uint16_t> graph(pixels + 2);
+        std::vector<int> slot(pixels + 2);
+        for (auto [u, v, c, bidirectional] : edges) {
+            graph.reserve_edges(u, 1);
+            graph.reserve_edges(v, 1);
+        }
+        graph.freeze();
+        for (auto [u, v, c, bidirectional] : edges) {
+            if (bidirectional)
+                graph.set_bidirectional_edge(u, slot[u]++, v, slot[v]++, c);
+            else
+                graph.set_directional_edge(u, slot[u]++, v, slot[v]++, c);
+        }
+
+        EXPECT_EQ(graph.max_flow(pixels, pixels + 1), reference.max_flow(pixels, pixels + 1));
+        EXPECT_EQ(graph.partition(pixels), reference.partition(pixels));
+    }
+}
+
+TEST_F(MaxFlowTest, EdmondsKarpRandomGraphs) {
+    for (unsigned seed = 0; seed != 50; ++seed) {
+        auto edges = random_graph(30, 120, seed);
+        expect_same_as_dinic<EdmondsKarp<int>>(30, edges, 0, 29);
+    }
+}
+
+TEST_F(MaxFlowTest, EdmondsKarpGrid) {
+    const int height = 60, width = 80, pixels = height * width;
+    auto edges = grid_graph(height, width, 3);
+    Dinic<int> reference(pixels + 2);
+    fill(reference, edges);
+    EdmondsKarp<int> graph(pixels + 2);
+    fill(graph, edges);
+
+    EXPECT_EQ(graph.max_flow(pixels, pixels + 1), reference.max_flow(pixels, pixels + 1));
+    EXPECT_EQ(graph.partition(pixels), reference.partition(pixels));
+    EXPECT_EQ(graph.min_cut(pixels), reference.min_cut(pixels));
+}
+
+TEST_F(MaxFlowTest, GridGraphTopology) {
+    GridGraph<int> grid(3, 4);
+    EXPECT_EQ(grid.V(), 14);
+    EXPECT_EQ(grid.head(5 * 4 + GridGraph<int>::RIGHT), 6);
+    EXPECT_EQ(grid.head(5 * 4 + GridGraph<int>::LEFT), 4);
+    EXPECT_EQ(grid.head(5 * 4 + GridGraph<int>::DOWN), 9);
+    EXPECT_EQ(grid.head(5 * 4 + GridGraph<int>::UP), 1);
+    for (int node = 0; node != grid.pixels(); ++node)
+        for (int a = grid.first_arc(node); a != GridGraph<int>::noarc; a = grid.next_arc(a))
+            EXPECT_EQ(grid.sister(grid.sister(a)), a);
+
+    grid.set_horizontal(5, 7);
+    EXPECT_EQ(grid.capacity(5 * 4 + GridGraph<int>::RIGHT), 7);
+    EXPECT_EQ(grid.capacity(6 * 4 + GridGraph<int>::LEFT), 7);
+    grid.add_directional_edge(grid.source(), 2, 3);
+    EXPECT_EQ(grid.source_plane()[2], 3);
+}
+
+TEST_F(MaxFlowTest, BoykovKolmogorovGridGraph) {
+    const int height = 40, width = 60, pixels = height * width;
+    for (unsigned seed = 0; seed != 5; ++seed) {
+        auto edges = grid_graph(height, width, seed);
+        Dinic<int> reference(pixels + 2);
+        fill(reference, edges);
+        BoykovKolmogorov<int, GridGraph<int>> graph(height, width);
+        fill(graph, edges);
+
+        EXPECT_EQ(graph.max_flow(pixels, pixels + 1), reference.max_flow(pixels, pixels + 1));
+        EXPECT_EQ(graph.partition(pixels), reference.partition(pixels));
+        EXPECT_EQ(graph.min_cut(pixels).size(), reference.min_cut(pixels).size());
+    }
+}
+
+TEST_F(MaxFlowTest, PushRelabelRandomGraphs) {
+    for (unsigned seed = 0; seed != 50; ++seed) {
+        auto edges = random_graph(30, 120, seed);
+        Dinic<int> reference(30);
+        fill(reference, edges);
+        PushRelabel<int> graph(30);
+        graph.set_threads(1 + seed % 4);
+        fill(graph, edges);
+
+        EXPECT_EQ(graph.max_flow(0, 29), reference.max_flow(0, 29));
+        EXPECT_EQ(graph.partition(0), reference.partition(0));
+    }
+}
+
+TEST_F(MaxFlowTest, PushRelabelGridGraph) {
+    const int height = 40, width = 60, pixels = height * width;
+    for (unsigned seed = 0; seed != 5; ++seed) {
+        auto edges = grid_graph(height, width, seed);
+        Dinic<int> reference(pixels + 2);
+        fill(reference, edges);
+        PushRelabel<int, GridGraph<int>> graph(height, width);
+        graph.set_threads(4);
+        fill(graph, edges);
+
+        EXPECT_EQ(graph.max_flow(pixels, pixels + 1), reference.max_flow(pixels, pixels + 1));
+        EXPECT_EQ(graph.partition(pixels), reference.partition(pixels));
+    }
+}
+
+TEST_F(MaxFlowTest, BoykovKolmogorovDynamicUpdates) {
+    const int height = 30, width = 40, pixels = height * width;
+    std::mt19937 gen(7);
+    // terminal per pixel: 1 source, -1 sink, 0 none
+    std::vector<int> terminal(pixels), right(pixels), down(pixels);
+    for (int i = 0; i != pixels; ++i) {
+        terminal[i] = static_cast<int>(gen() % 3) - 1;
+        right[i] = (i + 1) % width ? 1 + gen() % 255 : 0;
+        down[i] = i + width < pixels ? 1 + gen() % 255 : 0;
+    }
+
+    BoykovKolmogorov<int, GridGraph<int>> graph(height, width);
+    for (int i = 0; i != pixels; ++i) {
+        if (right[i])
+            graph.graph().set_horizontal(i, right[i]);
+        if (down[i])
+            graph.graph().set_vertical(i, down[i]);
+        if (terminal[i])
+            graph.add_directional_edge(terminal[i] > 0 ? pixels : i, terminal[i] > 0 ? i : pixels + 1, 23);
+    }
+    graph.max_flow(pixels, pixels + 1);
+
+    for (int round = 0; round != 10; ++round) {
+        for (int k = 0; k != 50; ++k) {
+            int i = gen() % pixels;
+            int t = static_cast<int>(gen() % 3) - 1;
+            graph.add_terminal_capacity(i, 23 * ((t > 0) - (terminal[i] > 0)), 23 * ((t < 0) - (terminal[i] < 0)));
+            terminal[i] = t;
+
+            int j = gen() % pixels;
+            auto& cap = gen() % 2 ? right[j] : down[j];
+            if (&cap == &right[j] ? (j + 1) % width == 0 : j + width >= pixels)
+                continue;
+            int new_cap = gen() % 4 ? 0 : 1 + gen() % 255;
+            auto dir = &cap == &right[j] ? GridGraph<int>::RIGHT : GridGraph<int>::DOWN;
+            graph.add_edge_capacity(GridGraph<int>::arc(j, dir), new_cap - cap, new_cap - cap);
+            cap = new_cap;
+        }
+
+        Dinic<int> reference(pixels + 2);
+        for (int i = 0; i != pixels; ++i) {
+            if (right[i])
+                reference.add_bidirectional_edge(i, i + 1, right[i]);
+            if (down[i])
+                reference.add_bidirectional_edge(i, i + width, down[i]);
+            if (terminal[i] > 0)
+                reference.add_directional_edge(pixels, i, 23);
+            else if (terminal[i] < 0)
+                reference.add_directional_edge(i, pixels + 1, 23);
+        }
+        EXPECT_EQ(graph.max_flow(pixels, pixels + 1), reference.max_flow(pixels, pixels + 1));
+        EXPECT_EQ(graph.partition(pixels), reference.partition(pixels));
+    }
+}
+
+TEST_F(MaxFlowTest, BoykovKolmogorovStopAndResume) {
+    const int height = 40, width = 60, pixels = height * width;
+    for (unsigned seed = 0; seed != 5; ++seed) {
+        auto edges = grid_graph(height, width, seed);
+        Dinic<int> reference(pixels + 2);
+        fill(reference, edges);
+        BoykovKolmogorov<int, GridGraph<int>> graph(height, width);
+        fill(graph, edges);
+
+        // stops at every poll until it has been asked a few times
+        int polls = 0;
+        graph.set_stop([&] { return ++polls <= 3; });
+        int calls = 0;
+        int flow = 0;
+        do {
+            flow = graph.max_flow(pixels, pixels + 1);
+            ++calls;
+        } while (graph.stopped());
+
+        EXPECT_GT(calls, 1);
+        EXPECT_EQ(flow, reference.max_flow(pixels, pixels + 1));
+        EXPECT_EQ(graph.partition(pixels), reference.partition(pixels));
+    }
+}
+
+TEST_F(MaxFlowTest, StoppedSolversAddUpToTheMaxFlow) {
+    const int height = 20, width = 30, pixels = height * width;
+    auto edges = grid_graph(height, width, 7);
+    Dinic<int> reference(pixels + 2);
+    fill(reference, edges);
+    const int expected = reference.max_flow(pixels, pixels + 1);
+
+    // Dinic and Edmonds-Karp keep their residual graph when stopped
+    auto stop_and_continue = [&](auto& graph) {
+        fill(graph, edges);
+        int polls = 0;
+        graph.set_stop([&] { return ++polls == 3; });
+        int flow = graph.max_flow(pixels, pixels + 1);
+        EXPECT_TRUE(graph.stopped());
+        flow += graph.max_flow(pixels, pixels + 1);
+        EXPECT_FALSE(graph.stopped());
+        EXPECT_EQ(flow, expected);
+        EXPECT_EQ(graph.partition(pixels), reference.partition(pixels));
+    };
+    Dinic<int> dinic(pixels + 2);
+    stop_and_continue(dinic);
+    EdmondsKarp<int> edmonds_karp(pixels + 2);
+    stop_and_continue(edmonds_karp);
+
+    // push-relabel starts over after a clear
+    PushRelabel<int, GridGraph<int>> push_relabel(height, width);
+    fill(push_relabel, edges);
+    push_relabel.set_stop([] { return true; });
+    push_relabel.max_flow(pixels, pixels + 1);
+    EXPECT_TRUE(push_relabel.stopped());
+    push_relabel.clear();
+    fill(push_relabel, edges);
+    EXPECT_EQ(push_relabel.max_flow(pixels, pixels + 1), expected);
+    EXPECT_FALSE(push_relabel.stopped());
+}
+
+TEST_F(MaxFlowTest, ClearedSolversMatchFreshOnes) {
+    const int height = 30, width = 40, pixels = height * width;
+    Dinic<int> dinic(pixels + 2);
+    EdmondsKarp<int> edmonds_karp(pixels + 2);
+    BoykovKolmogorov<int> arcs(pixels + 2);
+    BoykovKolmogorov<int, GridGraph<int>> grid(height, width);
+    PushRelabel<int, GridGraph<int>> push_relabel(height, width);
+    push_relabel.set_threads(2);
+
+    for (unsigned seed = 0; seed != 3; ++seed) {
+        auto edges = grid_graph(height, width, seed);
+        Dinic<int> reference(pixels + 2);
+        fill(reference, edges);
+        const int flow = reference.max_flow(pixels, pixels + 1);
+        const auto partition = reference.partition(pixels);
+
+        auto check = [&](auto& graph) {
+            graph.clear();
+            fill(graph, edges);
+            EXPECT_EQ(graph.max_flow(pixels, pixels + 1), flow);
+            EXPECT_EQ(graph.partition(pixels), partition);
+        };
+        check(dinic);
+        check(edmonds_karp);
+        check(arcs);
+        check(grid);
+        check(push_relabel);
+    }
+}
@@ -0,0 +1,373 @@
+#include <gtest/gtest.h>
+
+#include <matrix_utils.hpp>
+#include <painter.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+class PainterTest : public ::testing::Test {
+protected:
+    static constexpr int height = 120;
+    static constexpr int width = 160;
+
+    // [x0, x1) x [y0, y1) inside 2 pixel strokes
+    struct Box {
+        int x0, y0, x1, y1;
+    };
+    // a wide box across several 32 pixel tiles and three below it
+    static constexpr std::array<Box, 4> boxes {{
+        {6, 6, 154, 58},
+        {6, 66, 50, 114},
+        {58, 66, 102, 114},
+        {110, 66, 154, 114},
+    }};
+
+    void SetUp() override {
+        drawing_path_ = testing::TempDir() + "painter_test_drawing.png";
+        auto drawing = page(boxes);
+        ASSERT_TRUE(imwrite(drawing_path_, drawing));
+        scribbles_ = Matrix<unsigned char>(height, width, 4);
+        scribble(scribbles_, 12, 12, {255, 0, 0});
+        scribble(scribbles_, 20, 100, {0, 200, 0});
+        scribble(scribbles_, 90, 80, {0, 0, 255});
+    }
+
+    // white paper with the outlines of boxes
+    static auto page(const std::array<Box, 4>& outlines) -> Matrix<unsigned char> {
+        Matrix<unsigned char> drawing(height, width, 3, 255);
+        auto* pt = drawing.pt();
+        auto ink = [pt](int x, int y) {
+            for (int c = 0; c != 3; ++c)
+                pt[3 * (y * width + x) + c] = 0;
+        };
+        for (auto& box : outlines) {
+            for (int t = 1; t <= 2; ++t) {
+                for (int x = box.x0 - 2; x != box.x1 + 2; ++x) {
+                    ink(x, box.y0 - t);
+                    ink(x, box.y1 - 1 + t);
+                }
+                for (int y = box.y0 - 2; y != box.y1 + 2; ++y) {
+                    ink(box.x0 - t, y);
+                    ink(box.x1 - 1 + t, y);
+                }
+            }
+        }
+        return drawing;
+    }
+
+    // square of radius r centered at x, y
+    static void scribble(
+            Matrix<unsigned char>& scribbles, int x, int y, std::array<u_char, 3> color, int r = 3) {
+        auto* pt = scribbles.pt();
+        for (int yy = y - r; yy <= y + r; ++yy) {
+            for (int xx = x - r; xx <= x + r; ++xx) {
+                int i = 4 * (yy * width + xx);
+                pt[i] = color[0];
+                pt[i+1] = color[1];
+                pt[i+2] = color[2];
+                pt[i+3] = 255;
+            }
+        }
+    }
+
+    // drawing after setup and one paint of the scribbles
+    auto painted(const std::function<void(Painter&)>& setup = {}) -> Matrix<unsigned char> {
+        Painter painter(drawing_path_.data());
+        EXPECT_FALSE(painter.empty());
+        if (setup)
+            setup(painter);
+        painter.paint(scribbles_);
+        return painter.drawing().copy();
+    }
+
+    static auto differing(const Matrix<unsigned char>& a, const Matrix<unsigned char>& b) -> int {
+        EXPECT_TRUE(a.shape() == b.shape());
+        const int channels = a.channels();
+        int count = 0;
+        for (size_t i = 0; i < a.size(); i += channels)
+            count += !std::equal(a.pt() + i, a.pt() + i + channels, b.pt() + i);
+        return count;
+    }
+
+    static auto color_at(const Matrix<unsigned char>& m, int x, int y) -> std::array<u_char, 3> {
+        auto* p = m.pt() + m.channels() * (y * width + x);
+        return {p[0], p[1], p[2]};
+    }
+
+    // far corners of the boxes with the fixture scribbles
+    static void expect_boxes_filled(const Matrix<unsigned char>& result) {
+        EXPECT_EQ(color_at(result, 150, 54), (std::array<u_char, 3> {255, 0, 0}));
+        EXPECT_EQ(color_at(result, 46, 70), (std::array<u_char, 3> {0, 200, 0}));
+        EXPECT_EQ(color_at(result, 60, 110), (std::array<u_char, 3> {0, 0, 255}));
+    }
+
+    std::string drawing_path_;
+    Matrix<unsigned char> scribbles_;
+};
+
+TEST_F(PainterTest, ScribblesFillTheirBoxes) {
+    expect_boxes_filled(painted());
+}
+
+TEST_F(PainterTest, RegionsMatchPaint) {
+    auto expected = painted();
+    EXPECT_EQ(differing(painted([](Painter& p) { p.set_stroke_threshold(100); }), expected), 0);
+}
+
+TEST_F(PainterTest, RegionsKeepPaletteOrder) {
+    // white paper around the boxes keeps them in regions of their own
+    for (int x = 2; x < width - 2; x += 3)
+        scribble(scribbles_, x, 117, {255, 255, 255}, 1);
+    // blue comes first in the palette from the box on the right, but
+    // green is first in raster order inside the blue box. Blue has more
+    // scribbles there and takes the box when it is cut first.
+    scribble(scribbles_, 130, 70, {0, 0, 255});
+    scribble(scribbles_, 90, 100, {0, 0, 255});
+    scribble(scribbles_, 70, 75, {0, 200, 0});
+    auto expected = painted();
+    EXPECT_EQ(differing(painted([](Painter& p) { p.set_stroke_threshold(100); }), expected), 0);
+}
+
+TEST_F(PainterTest, PyramidMatchesPaint) {
+    // a third level would merge the 4 pixels of paper between the boxes
+    // into their strokes
+    auto expected = painted();
+    for (int levels : {1, 2})
+        EXPECT_EQ(differing(painted([levels](Painter& p) { p.set_pyramid_levels(levels); }), expected), 0)
+            << levels << " levels";
+}
+
+TEST_F(PainterTest, PyramidWeighsScribblesByArea) {
+    // a small scribble outweighs the strokes of its box only when every
+    // scribble pixel it covers counts, with white paper left outside
+    for (int r : {1, 2}) {
+        scribbles_ = Matrix<unsigned char>(height, width, 4);
+        for (int x = 2; x < width - 2; x += 3)
+            scribble(scribbles_, x, 117, {255, 255, 255}, 1);
+        scribble(scribbles_, 28, 90, {0, 200, 0}, r);
+        scribble(scribbles_, 80, 30, {255, 0, 0}, r);
+        auto expected = painted();
+        for (int levels : {1, 2})
+            EXPECT_EQ(differing(painted([levels](Painter& p) { p.set_pyramid_levels(levels); }), expected), 0)
+                << "radius " << r << ", " << levels << " levels";
+    }
+}
+
+TEST_F(PainterTest, TilesMatchPaint) {
+    // the red scribble sits in one corner tile of the wide box
+    auto expected = painted();
+    for (int tile : {32, 64})
+        EXPECT_EQ(differing(painted([tile](Painter& p) { p.set_tile_size(tile); }), expected), 0)
+            << tile << " pixel tiles";
+}
+
+TEST_F(PainterTest, SuperpixelsMatchPaint) {
+    // 2 pixel gaps from the wide box into box B and from B into C, which
+    // superpixels flow through
+    auto drawing = page(boxes);
+    for (int gap = 0; gap != 2; ++gap) {
+        for (int t = 0; t != 8; ++t) {
+            for (int c = 0; c != 3; ++c) {
+                drawing.pt()[3 * ((58 + t) * width + 26 + gap) + c] = 255;
+                drawing.pt()[3 * ((86 + gap) * width + 50 + t) + c] = 255;
+            }
+        }
+    }
+    ASSERT_TRUE(imwrite(drawing_path_, drawing));
+    auto expected = painted();
+    for (int size : {8, 16})
+        EXPECT_EQ(differing(painted([size](Painter& p) { p.set_superpixel_size(size); }), expected), 0)
+            << size << " pixel superpixels";
+}
+
+TEST_F(PainterTest, PreviewKeepsTheLastPaintToRepaint) {
+    Painter painter(drawing_path_.data());
+    painter.set_repaint_margin(8);
+    painter.paint(scribbles_);
+    auto edited = scribbles_.copy();
+    scribble(edited, 130, 90, {0, 200, 0});
+    painter.preview(edited);
+    // a repaint reports once at the end, a full paint after every color
+    int reports = 0;
+    painter.paint_async(edited, [&reports](int, int) { ++reports; });
+    painter.wait_paint();
+    EXPECT_EQ(reports, 1);
+    auto repainted = painter.drawing().copy();
+    scribbles_ = edited.copy();
+    EXPECT_EQ(differing(repainted, painted()), 0);
+}
+
+TEST_F(PainterTest, IncrementalMatchesPaint) {
+    // more colors than the painter keeps graphs for
+    scribble(scribbles_, 130, 90, {255, 255, 0});
+    scribble(scribbles_, 140, 30, {255, 0, 255});
+    scribble(scribbles_, 80, 40, {0, 255, 255});
+    Painter painter(drawing_path_.data());
+    painter.set_incremental(true);
+    painter.paint(scribbles_);
+    EXPECT_EQ(differing(painter.drawing(), painted()), 0);
+    scribble(scribbles_, 30, 80, {0, 0, 255});
+    painter.paint(scribbles_);
+    EXPECT_EQ(differing(painter.drawing(), painted()), 0);
+}
+
+TEST_F(PainterTest, MultiLabelMatchesPaintWithoutContest) {
+    // every box holds one color, no region is left to the cheaper one
+    auto expected = painted();
+    EXPECT_EQ(differing(painted([](Painter& p) { p.set_multi_label(true); }), expected), 0);
+}
+
+TEST_F(PainterTest, PreviewFillsTheBoxes) {
+    // the fill is approximate off the boxes, the ring and the empty box
+    // may go to another color than in paint
+    Painter painter(drawing_path_.data());
+    painter.preview(scribbles_);
+    expect_boxes_filled(painter.drawing());
+}
+
+TEST_F(PainterTest, BudgetPaintsExactlyWhileTimeLasts) {
+    auto expected = painted();
+    Painter painter(drawing_path_.data());
+    auto exact = painter.paint_within(scribbles_, std::chrono::seconds(10));
+    EXPECT_EQ(std::count(exact.begin(), exact.end(), false), 0);
+    EXPECT_EQ(differing(painter.drawing(), expected), 0);
+
+    // out of time every color is filled approximately
+    Painter late(drawing_path_.data());
+    exact = late.paint_within(scribbles_, std::chrono::milliseconds(0));
+    EXPECT_EQ(std::count(exact.begin(), exact.end(), true), 0);
+    expect_boxes_filled(late.drawing());
+}
+
+TEST_F(PainterTest, PaletteMergeMatchesPaintOfMergedColors) {
+    // a slightly different red in the empty box joins the red of the
+    // wide box, which has more scribble pixels
+    auto merged = scribbles_.copy();
+    scribble(merged, 130, 90, {255, 0, 0}, 1);
+    scribble(scribbles_, 130, 90, {250, 4, 0}, 1);
+    // a single yellow pixel in the green box is dropped
+    scribble(scribbles_, 40, 100, {255, 255, 0}, 0);
+    auto result = painted([](Painter& p) {
+        p.set_color_tolerance(8);
+        p.set_min_color_pixels(2);
+    });
+    scribbles_ = merged.copy();
+    EXPECT_EQ(differing(result, painted()), 0);
+}
+
+TEST_F(PainterTest, RepaintMatchesPaint) {
+    Painter painter(drawing_path_.data());
+    painter.set_repaint_margin(8);
+    painter.paint(scribbles_);
+    EXPECT_EQ(differing(painter.drawing(), painted()), 0);
+
+    // a new color in the blue box, then the green one recolored
+    scribble(scribbles_, 95, 110, {255, 255, 0});
+    painter.paint(scribbles_);
+    EXPECT_EQ(differing(painter.drawing(), painted()), 0) << "added";
+    scribble(scribbles_, 20, 100, {0, 0, 255});
+    painter.paint(scribbles_);
+    EXPECT_EQ(differing(painter.drawing(), painted()), 0) << "recolored";
+}
+
+TEST_F(PainterTest, RepaintKeepsTheMode) {
+    for (auto mode : std::vector<std::function<void(Painter&)>> {
+            [](Painter& p) { p.set_stroke_threshold(100); },
+            [](Painter& p) { p.set_multi_label(true); },
+            [](Painter& p) { p.set_superpixel_size(8); }}) {
+        auto scribbles = scribbles_.copy();
+        Painter painter(drawing_path_.data());
+        painter.set_repaint_margin(8);
+        mode(painter);
+        painter.paint(scribbles_);
+
+        // yellow contests the blue box, green fills the paper around boxes
+        scribble(scribbles_, 95, 110, {255, 255, 0});
+        scribble(scribbles_, 80, 61, {0, 200, 0}, 1);
+        painter.paint(scribbles_);
+        EXPECT_EQ(differing(painter.drawing(), painted(mode)), 0);
+        scribbles_ = std::move(scribbles);
+    }
+}
+
+TEST_F(PainterTest, AsyncMatchesPaint) {
+    auto expected = painted();
+    Painter painter(drawing_path_.data());
+    std::vector<int> done, colors;
+    painter.paint_async(scribbles_, [&](int d, int c) {
+        done.push_back(d);
+        colors.push_back(c);
+    });
+    painter.wait_paint();
+    EXPECT_EQ(differing(painter.drawing(), expected), 0);
+    // after every cut and once at the end
+    EXPECT_EQ(done, (std::vector<int> {1, 2, 3, 3}));
+    EXPECT_EQ(colors, (std::vector<int> {3, 3, 3, 3}));
+    int version = 0;
+    EXPECT_TRUE(painter.read_snapshot(version, [&](const Matrix<unsigned char>& snapshot) {
+        EXPECT_EQ(differing(snapshot, expected), 0);
+    }));
+}
+
+TEST_F(PainterTest, CancelledPaintLeavesAUsablePainter) {
+    for (auto mode : std::vector<std::function<void(Painter&)>> {
+            [](Painter& p) { p.set_stroke_threshold(100); },
+            [](Painter& p) { p.set_multi_label(true); },
+            [](Painter& p) { p.set_superpixel_size(8); }}) {
+        Painter painter(drawing_path_.data());
+        mode(painter);
+        painter.paint_async(scribbles_);
+        painter.cancel_paint();
+        EXPECT_TRUE(painter.paint_done());
+        painter.paint(scribbles_);
+        EXPECT_EQ(differing(painter.drawing(), painted(mode)), 0);
+    }
+}
+
+TEST_F(PainterTest, NextFrameMatchesPaint) {
+    Painter painter(drawing_path_.data());
+    painter.set_repaint_margin(8);
+    painter.set_incremental(true);
+    painter.paint(scribbles_);
+
+    // the blue box moves 4 pixels right in the next frame
+    auto moved = boxes;
+    moved[2].x0 += 4;
+    moved[2].x1 += 4;
+    auto next_path = testing::TempDir() + "painter_test_next.png";
+    auto next = page(moved);
+    ASSERT_TRUE(imwrite(next_path, next));
+    ASSERT_TRUE(painter.paint_next_frame(next_path.data(), scribbles_));
+    drawing_path_ = next_path;
+    EXPECT_EQ(differing(painter.drawing(), painted()), 0);
+
+    // a larger frame rejects the scribbles but is loaded, no seeds or
+    // flows of the smaller one are left to repaint from
+    painter.paint(scribbles_);
+    Matrix<unsigned char> large(2 * height, 2 * width, 3, 255);
+    auto large_path = testing::TempDir() + "painter_test_large.png";
+    ASSERT_TRUE(imwrite(large_path, large));
+    EXPECT_FALSE(painter.paint_next_frame(large_path.data(), scribbles_));
+    Matrix<unsigned char> large_scribbles(2 * height, 2 * width, 4);
+    painter.paint(large_scribbles);
+    Painter fresh(large_path.data());
+    fresh.paint(large_scribbles);
+    EXPECT_EQ(differing(painter.drawing(), fresh.drawing()), 0);
+}
+
+TEST_F(PainterTest, MaxColorsKeepsWhiteOutOfThePalette) {
+    // white leaves its box unpainted and has more scribble pixels than
+    // red, but only red is a color to keep
+    scribbles_ = Matrix<unsigned char>(height, width, 4);
+    scribble(scribbles_, 12, 12, {255, 0, 0}, 1);
+    scribble(scribbles_, 20, 100, {255, 255, 255});
+    auto expected = painted();
+    auto result = painted([](Painter& p) { p.set_max_colors(1); });
+    EXPECT_EQ(differing(result, expected), 0);
+    EXPECT_EQ(color_at(result, 150, 54), (std::array<u_char, 3> {255, 0, 0}));
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+
+#include <pixel_kernels.hpp>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+class PixelKernelsTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        set_simd_level(supported_simd_level());
+    }
+
+    // every level up to the supported one
+    static auto levels() -> std::vector<SimdLevel> {
+        std::vector<SimdLevel> result = {SimdLevel::SCALAR};
+        if (supported_simd_level() >= SimdLevel::SSSE3)
+            result.push_back(SimdLevel::SSSE3);
+        if (supported_simd_level() >= SimdLevel::AVX2)
+            result.push_back(SimdLevel::AVX2);
+        return result;
+    }
+
+    // odd sizes leave tails for the scalar loops
+    static auto random_bytes(int size, int seed) -> std::vector<std::uint8_t> {
+        std::mt19937 gen(seed);
+        std::uniform_int_distribution<int> byte(0, 255);
+        std::vector<std::uint8_t> result(size);
+        for (auto& b : result)
+            b = byte(gen);
+        return result;
+    }
+};
+
+TEST_F(PixelKernelsTest, SquareTableMatchesPow) {
+    auto table = GammaTable([](double x) {
+        return static_cast<int>(std::pow(x, 2.0) * 255.0);
+    });
+    EXPECT_EQ(gamma_table(1/2.0).threshold, table.threshold);
+    EXPECT_EQ(gamma_table(1/2.0).low, table.low);
+}
+
+TEST_F(PixelKernelsTest, GrayMatchesPow) {
+    // every red and green, blue in steps of 5 up to 255
+    std::vector<std::uint8_t> rgb;
+    for (int r = 0; r != 256; ++r)
+        for (int g = 0; g != 256; ++g)
+            for (int b = 0; b < 256; b += 5)
+                rgb.insert(rgb.end(), {std::uint8_t(r), std::uint8_t(g), std::uint8_t(b)});
+    const int pixels = rgb.size() / 3;
+
+    for (float gamma : {1/2.0f, 1/2.2f, 1.f, 2.2f}) {
+        std::vector<std::uint8_t> expected(pixels);
+        for (int i = 0; i < pixels; ++i) {
+            auto x = (rgb[3*i]*0.2126 + rgb[3*i+1]*0.7152 + rgb[3*i+2]*0.0722 + 0.3) / 255.0;
+            expected[i] = static_cast<unsigned char>(std::pow(x, 1/gamma) * 255.0);
+        }
+        auto table = gamma_table(gamma);
+        for (auto simd : levels()) {
+            set_simd_level(simd);
+            std::vector<std::uint8_t> gray(pixels);
+            rgb_to_gray(rgb.data(), gray.data(), pixels, table);
+            EXPECT_EQ(gray, expected) << "gamma " << gamma << " level " << static_cast<int>(simd);
+        }
+    }
+}
+
+TEST_F(PixelKernelsTest, RgbaExpansion) {
+    for (int pixels : {0, 1, 5, 6, 9, 10, 1001}) {
+        auto rgb = random_bytes(3 * pixels, pixels);
+        std::vector<std::uint8_t> expected;
+        for (int i = 0; i < pixels; ++i)
+            expected.insert(expected.end(), {rgb[3*i], rgb[3*i+1], rgb[3*i+2], 255});
+        for (auto simd : levels()) {
+            set_simd_level(simd);
+            std::vector<std::uint8_t> rgba(4 * pixels);
+            rgb_to_rgba(rgb.data(), rgba.data(), pixels);
+            EXPECT_EQ(rgba, expected) << pixels << " pixels, level " << static_cast<int>(simd);
+        }
+    }
+}
+
+TEST_F(PixelKernelsTest, CompositeLabels) {
+    const int colors = 5;
+    auto bytes = random_bytes(3 * colors, 0);
+    std::vector<float> factor(3 * (colors + 1), 1.f);
+    for (int k = 0; k != 3 * colors; ++k)
+        factor[k] = bytes[k] / 255.f;
+
+    for (int pixels : {0, 1, 9, 10, 1001}) {
+        auto rgb = random_bytes(3 * pixels, pixels);
+        std::vector<std::uint16_t> labels(pixels);
+        for (int i = 0; i < pixels; ++i)
+            labels[i] = i % 7 == 6 ? 0xffff : i % 7;
+
+        std::vector<std::uint8_t> expected(4 * pixels);
+        for (int i = 0; i < pixels; ++i) {
+            const float* f = factor.data() + 3 * std::min<int>(labels[i], colors);
+            for (int c = 0; c != 3; ++c)
+                expected[4*i+c] = rgb[3*i+c] * f[c];
+            expected[4*i+3] = 255;
+        }
+        for (auto simd : levels()) {
+            set_simd_level(simd);
+            std::vector<std::uint8_t> rgba(4 * pixels);
+            composite_labels(rgb.data(), labels.data(), colors, factor.data(), rgba.data(), pixels);
+            EXPECT_EQ(rgba, expected) << pixels << " pixels, level " << static_cast<int>(simd);
+        }
+    }
+}